@@ -144,12 +144,24 @@ bool d3d::InitD3D(
 	return true;
 }
 
-int d3d::EnterMsgLoop( bool (*ptr_display)(float timeDelta) )
+int d3d::EnterMsgLoop(
+	bool (*ptr_update)(float timeDelta),
+	bool (*ptr_display)(float alpha),
+	float tickRate,
+	float maxFrameRate)
 {
 	MSG msg;
 	::ZeroMemory(&msg, sizeof(MSG));
 
+	// game time advances 0.0007 per millisecond of real time
+	const double timeScale   = 0.0007;
+	const double tickTime    = 1000.0 / tickRate;
+	const double minFrame    = maxFrameRate > 0.0f ? 1000.0 / maxFrameRate : 0.0;
+	// after a stall (window drag, breakpoint) skip ahead instead of catching up
+	const double maxFrame    = 250.0;
+
 	static double lastTime = (double)timeGetTime(); 
+	double accumulator = 0.0;
 
 	while(msg.message != WM_QUIT)
 	{
@@ -161,10 +173,24 @@ int d3d::EnterMsgLoop( bool (*ptr_display)(float timeDelta) )
 		else
         {	
 			double currTime  = (double)timeGetTime();
-			double timeDelta = (currTime - lastTime)*0.0007;
-			ptr_display((float)timeDelta);
-
+			double frameTime = currTime - lastTime;
+			if( frameTime < minFrame )
+			{
+				::Sleep(0);
+				continue;
+			}
 			lastTime = currTime;
+
+			if( frameTime > maxFrame )
+				frameTime = maxFrame;
+			accumulator += frameTime;
+
+			while( accumulator >= tickTime )
+			{
+				ptr_update((float)(tickTime * timeScale));
+				accumulator -= tickTime;
+			}
+			ptr_display((float)(accumulator / tickTime));
         }
     }
     return msg.wParam;
@@ -236,6 +262,20 @@ D3DMATERIAL9 d3d::InitMtrl(D3DXCOLOR a, D3DXCOLOR d, D3DXCOLOR s, D3DXCOLOR e, f
 	return mtrl;
 }
 
+d3d::ResourceRegistry::~ResourceRegistry()
+{
+	releaseAll();
+}
+
+void d3d::ResourceRegistry::releaseAll()
+{
+	while( !_objects.empty() )
+	{
+		_objects.back()->Release();
+		_objects.pop_back();
+	}
+}
+
 d3d::BoundingBox::BoundingBox()
 {
 	// infinite small 
@@ -248,7 +288,7 @@ d3d::BoundingBox::BoundingBox()
 	_max.z = -INFINITY;
 }
 
-bool d3d::BoundingBox::isPointInside(D3DXVECTOR3& p)
+bool d3d::BoundingBox::isPointInside(const render::Vec3& p) const
 {
 	if( p.x >= _min.x && p.y >= _min.y && p.z >= _min.z &&
 		p.x <= _max.x && p.y <= _max.y && p.z <= _max.z )
@@ -263,5 +303,55 @@ bool d3d::BoundingBox::isPointInside(D3DXVECTOR3& p)
 
 d3d::BoundingSphere::BoundingSphere()
 {
+	_center = render::vec3(0.0f, 0.0f, 0.0f);
 	_radius = 0.0f;
 }
+
+d3d::Frustum::Frustum()
+{
+	// everything is inside until extract() is called
+	for (int i = 0; i < 6; i++)
+		_planes[i] = render::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+void d3d::Frustum::extract(const render::Matrix& viewProj)
+{
+	// the columns of the matrix: x, y, z and w of clip space as planes
+	const float (*m)[4] = viewProj.m;
+	render::Vec4 col[4];
+	for (int j = 0; j < 4; j++)
+		col[j] = render::vec4(m[0][j], m[1][j], m[2][j], m[3][j]);
+
+	// left, right, bottom, top, near, far
+	_planes[0] = col[3] + col[0];
+	_planes[1] = col[3] - col[0];
+	_planes[2] = col[3] + col[1];
+	_planes[3] = col[3] - col[1];
+	_planes[4] = col[2];
+	_planes[5] = col[3] - col[2];
+	for (int i = 0; i < 6; i++)
+		_planes[i] = render::planeNormalize(_planes[i]);
+}
+
+bool d3d::Frustum::isVisible(const BoundingSphere& sphere) const
+{
+	for (int i = 0; i < 6; i++) {
+		if (render::planeDot(_planes[i], sphere._center) < -sphere._radius)
+			return false;
+	}
+	return true;
+}
+
+bool d3d::Frustum::isVisible(const BoundingBox& box) const
+{
+	// the box is out if its corner farthest along a plane normal is behind the plane
+	for (int i = 0; i < 6; i++) {
+		const render::Vec4& p = _planes[i];
+		render::Vec3 v = render::vec3(p.x >= 0.0f ? box._max.x : box._min.x,
+									  p.y >= 0.0f ? box._max.y : box._min.y,
+									  p.z >= 0.0f ? box._max.z : box._min.z);
+		if (render::planeDot(p, v) < 0.0f)
+			return false;
+	}
+	return true;
+}
@@ -14,8 +14,10 @@
 #define __d3dUtilityH__
 
 #include <d3dx9.h>
+#include "legoMath.h"
 #include <string>
 #include <limits>
+#include <vector>
 
 //#define INFINITY FLT_MAX
 
@@ -35,8 +37,15 @@ namespace d3d
 		D3DDEVTYPE deviceType,     // [in] HAL or REF
 		IDirect3DDevice9** device);// [out]The created device.
 
+	// Runs ptr_update with a fixed timeDelta 'tickRate' times per second of real
+	// time, and ptr_display once per frame with alpha in [0,1): how far the
+	// frame lies between the last two updates. maxFrameRate = 0 draws as often
+	// as possible.
 	int EnterMsgLoop( 
-		bool (*ptr_display)(float timeDelta));
+		bool (*ptr_update)(float timeDelta),
+		bool (*ptr_display)(float alpha),
+		float tickRate,
+		float maxFrameRate = 0.0f);
 
 	LRESULT CALLBACK WndProc(
 		HWND hwnd,
@@ -65,6 +74,28 @@ namespace d3d
 		}
 	}
 
+	// COM objects that go away together, e.g. the meshes of one level. releaseAll()
+	// releases them in reverse order of add().
+	class ResourceRegistry
+	{
+	public:
+		~ResourceRegistry();
+
+		// returns p, so a creation can be wrapped: registry.add(mesh)
+		template<class T> T* add(T* p)
+		{
+			if( p )
+				_objects.push_back(p);
+			return p;
+		}
+
+		void releaseAll();
+		size_t size() const { return _objects.size(); }
+
+	private:
+		std::vector<IUnknown*> _objects;
+	};
+
 	//
 	// Colors
 	//
@@ -102,28 +133,45 @@ namespace d3d
 	// Bounding Objects / Math Objects
 	//
 
+	// in the math of legoMath.h, which does not need the DirectX SDK
+
 	struct BoundingBox
 	{
 		BoundingBox();
 
-		bool isPointInside(D3DXVECTOR3& p);
+		bool isPointInside(const render::Vec3& p) const;
 
-		D3DXVECTOR3 _min;
-		D3DXVECTOR3 _max;
+		render::Vec3 _min;
+		render::Vec3 _max;
 	};
 
 	struct BoundingSphere
 	{
 		BoundingSphere();
 
-		D3DXVECTOR3 _center;
-		float       _radius;
+		render::Vec3 _center;
+		float        _radius;
 	};
 
 	struct Ray
 	{
-		D3DXVECTOR3 _origin;
-		D3DXVECTOR3 _direction;
+		render::Vec3 _origin;
+		render::Vec3 _direction;
+	};
+
+	// the six planes of a view volume, pointing inwards. built from view * projection
+	// to cull in world space, or from world * view * projection for model space.
+	struct Frustum
+	{
+		Frustum();
+
+		void extract(const render::Matrix& viewProj);
+
+		// conservative: near a corner of the frustum a bound may pass that is outside
+		bool isVisible(const BoundingSphere& sphere) const;
+		bool isVisible(const BoundingBox& box) const;
+
+		render::Vec4 _planes[6];    // (a, b, c, d), normalized
 	};
 
 	//
@@ -0,0 +1,458 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoBalls.h
+//
+// Desc: Structure-of-arrays storage for the balls of the physics core, and the SIMD
+//       kernel that integrates all of them at once (AVX / SSE2 / scalar). Live balls are
+//       kept packed; HandleTable gives them ids that stay valid while others come and go.
+//       The arrays may live in an Arena, so a whole level is freed at once.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoBallsH__
+#define __legoBallsH__
+
+#include "legoFixed.h"
+#include "legoSnapshot.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PHYS_AVX 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PHYS_SSE2 1
+#endif
+
+namespace phys
+{
+	// every array starts on a cache line, so the kernels can use aligned loads
+	const size_t SIMD_ALIGN = 64;
+
+	inline void* alignedAlloc(size_t bytes)
+	{
+		void* p = 0;
+#if defined(_MSC_VER)
+		p = _aligned_malloc(bytes, SIMD_ALIGN);
+#else
+		if (posix_memalign(&p, SIMD_ALIGN, bytes) != 0)
+			p = 0;
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	inline void alignedFree(void* p)
+	{
+#if defined(_MSC_VER)
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	//
+	// Arena: bump allocator for the data of one level. Nothing is freed on its own;
+	// reset() drops everything at once and keeps the memory, merged into one block, for
+	// the next level, so loading level after level neither leaks nor fragments the heap.
+	//
+
+	class Arena
+	{
+	public:
+		explicit Arena(size_t blockSize = 1 << 20) : m_blockSize(blockSize), m_used(0) {}
+		~Arena() { release(); }
+
+		// SIMD_ALIGN aligned, zeroed
+		void* allocate(size_t bytes)
+		{
+			bytes = (bytes + SIMD_ALIGN - 1) / SIMD_ALIGN * SIMD_ALIGN;
+			if (m_blocks.empty() || m_used + bytes > m_blocks.back().size) {
+				Block b;
+				b.size = bytes > m_blockSize ? bytes : m_blockSize;
+				b.data = (char*)alignedAlloc(b.size);
+				m_blocks.push_back(b);
+				m_used = 0;
+			}
+			void* p = m_blocks.back().data + m_used;
+			memset(p, 0, bytes);
+			m_used += bytes;
+			return p;
+		}
+
+		// everything allocated so far is gone
+		void reset(void)
+		{
+			size_t total = capacity();
+			if (m_blocks.size() > 1) {
+				release();
+				Block b;
+				b.size = total;
+				b.data = (char*)alignedAlloc(total);
+				m_blocks.push_back(b);
+			}
+			m_used = 0;
+		}
+
+		// give the memory back to the heap
+		void release(void)
+		{
+			for (size_t i = 0; i < m_blocks.size(); i++)
+				alignedFree(m_blocks[i].data);
+			m_blocks.clear();
+			m_used = 0;
+		}
+
+		size_t capacity(void) const
+		{
+			size_t total = 0;
+			for (size_t i = 0; i < m_blocks.size(); i++)
+				total += m_blocks[i].size;
+			return total;
+		}
+
+	private:
+		Arena(const Arena&);
+		Arena& operator=(const Arena&);
+
+		struct Block
+		{
+			char*  data;
+			size_t size;
+		};
+
+		size_t             m_blockSize;
+		size_t             m_used;      // in the last block
+		std::vector<Block> m_blocks;
+	};
+
+	//
+	// AlignedArray: growable array of POD elements on SIMD_ALIGN boundary. It can also
+	// borrow memory it does not own (see adopt()), e.g. a mapped level file, or take its
+	// memory from an Arena (see setArena()).
+	//
+
+	template<class T> class AlignedArray
+	{
+	public:
+		AlignedArray() : m_data(0), m_size(0), m_capacity(0), m_borrowed(false), m_arena(0) {}
+		AlignedArray(const AlignedArray& rhs) : m_data(0), m_size(0), m_capacity(0), m_borrowed(false), m_arena(0) { *this = rhs; }
+		~AlignedArray() { release(); }
+
+		// copies never borrow from the source, so they outlive whatever the source
+		// borrowed. the arena is not copied either.
+		AlignedArray& operator=(const AlignedArray& rhs)
+		{
+			if (this != &rhs) {
+				if (m_borrowed)
+					release();
+				resize(rhs.m_size);
+				if (m_size)
+					memcpy(m_data, rhs.m_data, m_size * sizeof(T));
+			}
+			return *this;
+		}
+
+		void reserve(size_t n)
+		{
+			if (n <= m_capacity)
+				return;
+			// round up to whole cache lines so a kernel may read a full vector past the end
+			size_t cap = m_capacity ? m_capacity * 2 : 16;
+			while (cap < n) cap *= 2;
+			T* data;
+			if (m_arena)
+				data = (T*)m_arena->allocate(cap * sizeof(T));
+			else {
+				data = (T*)alignedAlloc(cap * sizeof(T));
+				memset(data, 0, cap * sizeof(T));
+			}
+			if (m_size)
+				memcpy(data, m_data, m_size * sizeof(T));
+			if (!m_borrowed)
+				alignedFree(m_data);
+			m_data = data;
+			m_capacity = cap;
+			m_borrowed = m_arena != 0;  // the arena frees it
+		}
+
+		// grow in 'arena' from now on; 0 for the heap. the arena must outlive the memory
+		// taken from it, i.e. clear() the array before resetting the arena.
+		void setArena(Arena* arena) { m_arena = arena; }
+
+		// use n elements at data in place. the caller keeps them alive until the array
+		// is cleared, assigned or grows past n.
+		void adopt(T* data, size_t n)
+		{
+			release();
+			m_data = data;
+			m_size = m_capacity = n;
+			m_borrowed = true;
+		}
+
+		void resize(size_t n) { reserve(n); m_size = n; }
+		void push_back(const T& v) { reserve(m_size + 1); m_data[m_size++] = v; }
+
+		// O(1) erase that does not keep the order: the last element fills the hole
+		void removeSwap(size_t i) { m_data[i] = m_data[m_size - 1]; m_size--; }
+
+		// borrowed memory is let go of here, owned memory is kept for reuse
+		void clear(void)
+		{
+			if (m_borrowed)
+				release();
+			m_size = 0;
+		}
+
+		size_t size(void) const { return m_size; }
+		T*       data(void)       { return m_data; }
+		const T* data(void) const { return m_data; }
+		T&       operator[](size_t i)       { return m_data[i]; }
+		const T& operator[](size_t i) const { return m_data[i]; }
+
+	private:
+		void release(void)
+		{
+			if (!m_borrowed)
+				alignedFree(m_data);
+			m_data = 0;
+			m_size = m_capacity = 0;
+			m_borrowed = false;
+		}
+
+		T*     m_data;
+		size_t m_size;
+		size_t m_capacity;
+		bool   m_borrowed;  // m_data is not ours to free
+		Arena* m_arena;
+	};
+
+	//
+	// BallStore: one array per ball attribute. bricks are boxes of width x depth, whose
+	// radius is that of the circle around the box; round balls have a width of 0.
+	//
+
+	struct BallStore
+	{
+		AlignedArray<float> x, y, z;
+		AlignedArray<float> vx, vz;
+		AlignedArray<float> radius;
+		AlignedArray<float> width, depth;
+		AlignedArray<int>   kind;
+
+		int size(void) const { return (int)x.size(); }
+
+		void setArena(Arena* arena)
+		{
+			x.setArena(arena); y.setArena(arena); z.setArena(arena);
+			vx.setArena(arena); vz.setArena(arena);
+			radius.setArena(arena); width.setArena(arena); depth.setArena(arena);
+			kind.setArena(arena);
+		}
+
+		void clear(void)
+		{
+			x.clear(); y.clear(); z.clear();
+			vx.clear(); vz.clear();
+			radius.clear(); width.clear(); depth.clear();
+			kind.clear();
+		}
+
+		int add(int k, float px, float py, float pz, float r, float w = 0.0f, float d = 0.0f)
+		{
+			x.push_back(px); y.push_back(py); z.push_back(pz);
+			vx.push_back(0.0f); vz.push_back(0.0f);
+			radius.push_back(r);
+			width.push_back(w); depth.push_back(d);
+			kind.push_back(k);
+			return size() - 1;
+		}
+
+		// the last ball moves into 'slot'
+		void remove(int slot)
+		{
+			x.removeSwap(slot); y.removeSwap(slot); z.removeSwap(slot);
+			vx.removeSwap(slot); vz.removeSwap(slot);
+			radius.removeSwap(slot); width.removeSwap(slot); depth.removeSwap(slot);
+			kind.removeSwap(slot);
+		}
+
+		void save(Snapshot& s) const
+		{
+			s.putArray(x); s.putArray(y); s.putArray(z);
+			s.putArray(vx); s.putArray(vz);
+			s.putArray(radius); s.putArray(width); s.putArray(depth);
+			s.putArray(kind);
+		}
+
+		bool restore(SnapshotReader& r)
+		{
+			return r.getArray(x) && r.getArray(y) && r.getArray(z)
+				&& r.getArray(vx) && r.getArray(vz)
+				&& r.getArray(radius) && r.getArray(width) && r.getArray(depth)
+				&& r.getArray(kind);
+		}
+	};
+
+	//
+	// HandleTable: stable ids for the slots of packed arrays. remove() pairs with a
+	// removeSwap() of the arrays, so live entries stay dense for the kernels; freed ids
+	// go on a free list and add() hands them out again. Both are O(1).
+	//
+
+	class HandleTable
+	{
+	public:
+		void clear(void)
+		{
+			m_slot.clear();
+			m_id.clear();
+			m_free.clear();
+		}
+
+		// ids 0..n-1 in slots 0..n-1
+		void reset(int n)
+		{
+			clear();
+			for (int i = 0; i < n; i++) {
+				m_slot.push_back(i);
+				m_id.push_back(i);
+			}
+		}
+
+		// id of a new entry appended at slot size()
+		int add(void)
+		{
+			int id;
+			if (!m_free.empty()) {
+				id = m_free.back();
+				m_free.pop_back();
+			}
+			else {
+				id = (int)m_slot.size();
+				m_slot.push_back(-1);
+			}
+			m_slot[id] = (int)m_id.size();
+			m_id.push_back(id);
+			return id;
+		}
+
+		// free 'id' and return its slot, which the entry of the last slot now takes
+		int remove(int id)
+		{
+			int slot = m_slot[id];
+			int last = m_id.back();
+			m_id[slot] = last;
+			m_slot[last] = slot;
+			m_id.pop_back();
+			m_slot[id] = -1;
+			m_free.push_back(id);
+			return slot;
+		}
+
+		bool alive(int id) const { return id >= 0 && id < (int)m_slot.size() && m_slot[id] >= 0; }
+		int slot(int id) const { return m_slot[id]; }
+		int id(int slot) const { return m_id[slot]; }
+		int size(void) const { return (int)m_id.size(); }
+		int numIds(void) const { return (int)m_slot.size(); }   // every id ever handed out is below this
+
+		void save(Snapshot& s) const
+		{
+			s.putArray(m_slot);
+			s.putArray(m_id);
+			s.putArray(m_free);
+		}
+
+		bool restore(SnapshotReader& r)
+		{
+			return r.getArray(m_slot) && r.getArray(m_id) && r.getArray(m_free);
+		}
+
+	private:
+		std::vector<int> m_slot;    // by id, -1 when free
+		std::vector<int> m_id;      // by slot
+		std::vector<int> m_free;
+	};
+
+	//
+	// Integration kernel
+	//
+
+	// x += k * vx, z += k * vz for every ball that moves faster than 0.01 on either
+	// axis (the same rule as ballUpdate), with k = TIME_SCALE * timeDelta. in fixed point
+	// SIMD only finds the balls that move.
+	inline void integrateBalls(float* x, float* z, const float* vx, const float* vz, int n, float k)
+	{
+		int i = 0;
+#if defined(PHYS_AVX) && !defined(PHYS_FIXED)
+		{
+			const __m256 vk   = _mm256_set1_ps(k);
+			const __m256 eps  = _mm256_set1_ps(0.01f);
+			const __m256 sign = _mm256_set1_ps(-0.0f);
+			for (; i + 8 <= n; i += 8) {
+				__m256 bvx = _mm256_load_ps(vx + i);
+				__m256 bvz = _mm256_load_ps(vz + i);
+				__m256 moving = _mm256_or_ps(
+					_mm256_cmp_ps(_mm256_andnot_ps(sign, bvx), eps, _CMP_GT_OQ),
+					_mm256_cmp_ps(_mm256_andnot_ps(sign, bvz), eps, _CMP_GT_OQ));
+				__m256 dx = _mm256_and_ps(moving, _mm256_mul_ps(vk, bvx));
+				__m256 dz = _mm256_and_ps(moving, _mm256_mul_ps(vk, bvz));
+				_mm256_store_ps(x + i, _mm256_add_ps(_mm256_load_ps(x + i), dx));
+				_mm256_store_ps(z + i, _mm256_add_ps(_mm256_load_ps(z + i), dz));
+			}
+		}
+#endif
+#if defined(PHYS_SSE2) && !defined(PHYS_FIXED)
+		{
+			const __m128 vk   = _mm_set1_ps(k);
+			const __m128 eps  = _mm_set1_ps(0.01f);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			for (; i + 4 <= n; i += 4) {
+				__m128 bvx = _mm_load_ps(vx + i);
+				__m128 bvz = _mm_load_ps(vz + i);
+				__m128 moving = _mm_or_ps(
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, bvx), eps),
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, bvz), eps));
+				__m128 dx = _mm_and_ps(moving, _mm_mul_ps(vk, bvx));
+				__m128 dz = _mm_and_ps(moving, _mm_mul_ps(vk, bvz));
+				_mm_store_ps(x + i, _mm_add_ps(_mm_load_ps(x + i), dx));
+				_mm_store_ps(z + i, _mm_add_ps(_mm_load_ps(z + i), dz));
+			}
+		}
+#endif
+		const Real rk(k);
+#if defined(PHYS_SSE2) && defined(PHYS_FIXED)
+		{
+			// only picks the balls that move; they move in fixed point
+			const __m128 eps  = _mm_set1_ps(0.01f);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			for (; i + 4 <= n; i += 4) {
+				int moving = _mm_movemask_ps(_mm_or_ps(
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_load_ps(vx + i)), eps),
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_load_ps(vz + i)), eps)));
+				for (int j = i; moving; j++, moving >>= 1) {
+					if (moving & 1) {
+						x[j] = toFloat(Real(x[j]) + rk * Real(vx[j]));
+						z[j] = toFloat(Real(z[j]) + rk * Real(vz[j]));
+					}
+				}
+			}
+		}
+#endif
+		for (; i < n; i++) {
+			if (std::fabs(vx[i]) > 0.01f || std::fabs(vz[i]) > 0.01f) {
+				x[i] = toFloat(Real(x[i]) + rk * Real(vx[i]));
+				z[i] = toFloat(Real(z[i]) + rk * Real(vz[i]));
+			}
+		}
+	}
+}
+
+#endif // __legoBallsH__
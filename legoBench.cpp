@@ -0,0 +1,490 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoBench.cpp
+//
+// Desc: Microbenchmarks of the physics hot paths (legoPhysics.h) at scales
+//       from the 6 balls of the game up to 100k objects. Prints a table and
+//       optionally writes the results as JSON, in the layout of Google
+//       Benchmark's --benchmark_out, for tracking regressions over time.
+//
+//       usage: legoBench [-filter text] [-json file] [-min_time seconds]
+//                        [-max_objects n]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoParticles.h"
+#include "legoPhysics.h"
+#include "legoPreview.h"
+#include "legoThreads.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+// one physics tick of the game: 120 Hz at 0.0007 game time per millisecond
+const float TimeDelta = 0.0007f * 1000.0f / 120.0f;
+
+const int Scales[] = { 6, 100, 1000, 10000, 100000 };
+
+struct Result
+{
+	std::string name;
+	std::string family;
+	int         objects;
+	long long   iterations;
+	double      ns;         // per iteration; one iteration touches every object once
+};
+
+// results are summed into this so the compiler can not drop the work
+static volatile float g_sink;
+
+// run f(n) with growing n until it takes at least minTime seconds. f returns the
+// seconds of its own time that should not be counted (e.g. restarting a game).
+template<class F>
+static double measure(F f, double minTime, long long& iterations)
+{
+	long long n = 1;
+	for (;;) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double excluded = f(n);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		double seconds = elapsed.count() - excluded;
+
+		if (seconds >= minTime || n >= (1LL << 40)) {
+			iterations = n;
+			return seconds * 1e9 / n;
+		}
+		// aim a little past minTime from the rate so far, at least doubling
+		long long next = seconds > 0.0 ? (long long)(n * minTime * 1.2 / seconds) : n * 10;
+		n = next > n * 2 ? next : n * 2;
+		if (n > (1LL << 40))
+			n = 1LL << 40;
+	}
+}
+
+//
+// Inputs
+//
+
+// n balls spread evenly over the table, moving in varied directions
+static std::vector<phys::Ball> makeBalls(int n)
+{
+	std::vector<phys::Ball> balls(n);
+	srand(1);
+	for (int i = 0; i < n; i++) {
+		phys::Ball& b = balls[i];
+		b.x = -phys::TABLE_HALF_X + 2.0f * phys::TABLE_HALF_X * rand() / RAND_MAX;
+		b.z = -phys::TABLE_HALF_Z + 2.0f * phys::TABLE_HALF_Z * rand() / RAND_MAX;
+		b.y = b.radius = phys::BALL_RADIUS;
+		b.width = b.depth = 0.0f;
+		b.vx = 4.0f * rand() / RAND_MAX - 2.0f;
+		b.vz = 4.0f * rand() / RAND_MAX - 2.0f;
+		b.kind = phys::BRICK;
+	}
+	return balls;
+}
+
+// a level with n bricks packed into the upper part of the table, shrunk as needed so
+// they do not overlap, and the shot already on its way
+static void makeWorld(phys::World& world, int n)
+{
+	const float minX = -2.7f, maxX = 2.7f, minZ = -2.0f, maxZ = 4.6f;
+	float spacing = std::sqrt((maxX - minX) * (maxZ - minZ) / n);
+	int columns = (int)((maxX - minX) / spacing) + 1;
+	float radius = 0.4f * spacing < phys::BALL_RADIUS ? 0.4f * spacing : phys::BALL_RADIUS;
+
+	phys::setupDefaultLevel(world);
+	phys::World level;
+	for (int i = 0; i < world.numWalls(); i++) {
+		const phys::Wall& w = world.wall(i);
+		level.addWall(w.x, w.z, w.width, w.depth, w.kind);
+	}
+	for (int i = 0; i < n; i++)
+		level.addBall(phys::BRICK, minX + spacing * (i % columns), maxZ - spacing * (i / columns), radius);
+	for (int i = 0; i < world.numBalls(); i++) {
+		phys::Ball b = world.ball(world.ballId(i));
+		if (b.kind != phys::BRICK)
+			level.addBall(b.kind, b.x, b.z, b.radius);
+	}
+	world = level;
+	world.launch(1.3f, 2.5f);
+}
+
+//
+// Benchmarks. each one processes n objects per iteration.
+//
+
+static double benchBallUpdate(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n);
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			for (int i = 0; i < n; i++)
+				phys::ballUpdate(balls[i], TimeDelta);
+		}
+		g_sink = balls[0].x;
+		return 0.0;
+	}, minTime, iterations);
+}
+
+static double benchIntegrate(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n);
+	phys::BallStore store;
+	for (int i = 0; i < n; i++) {
+		store.add(phys::BRICK, balls[i].x, balls[i].y, balls[i].z, balls[i].radius);
+		store.vx[i] = balls[i].vx;
+		store.vz[i] = balls[i].vz;
+	}
+	const float k = phys::TIME_SCALE * TimeDelta;
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++)
+			phys::integrateBalls(store.x.data(), store.z.data(), store.vx.data(), store.vz.data(), n, k);
+		g_sink = store.x[0];
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// ball i against ball i + 1
+static double benchBallIntersect(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n + 1);
+	return measure([&](long long count) {
+		int hits = 0;
+		for (long long it = 0; it < count; it++) {
+			for (int i = 0; i < n; i++)
+				hits += phys::hasIntersected(balls[i], balls[i + 1]);
+		}
+		g_sink = (float)hits;
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// every ball hit by its neighbour; half of the pairs touch so deflect() runs too
+static double benchBallHitBy(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n + 1);
+	for (int i = 0; i < n; i += 2) {
+		balls[i + 1].x = balls[i].x + phys::BALL_RADIUS;
+		balls[i + 1].z = balls[i].z;
+	}
+	std::vector<phys::Ball> work(balls);
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			for (int i = 0; i < n; i++)
+				phys::hitBy(balls[i + 1], work[i]);
+		}
+		g_sink = work[0].vx;
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// every ball against the four walls of the table, a quarter of them touching
+static double benchWallHitBy(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n);
+	for (int i = 0; i < n; i += 4)
+		balls[i].x = phys::TABLE_HALF_X;
+	phys::World table;
+	phys::setupDefaultLevel(table);
+	std::vector<phys::Ball> work(balls);
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			for (int i = 0; i < n; i++) {
+				for (int w = 0; w < table.numWalls(); w++)
+					phys::hitBy(table.wall(w), work[i]);
+			}
+		}
+		g_sink = work[0].vx;
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// the walls of the table and eight obstacles inside it, as an arena might have
+static phys::WallStore makeArena(void)
+{
+	phys::World table;
+	phys::setupDefaultLevel(table);
+	phys::WallStore walls;
+	for (int i = 0; i < table.numWalls(); i++) {
+		const phys::Wall& w = table.wall(i);
+		walls.add(w.x, w.z, w.width, w.depth);
+	}
+	for (int i = 0; i < 8; i++)
+		walls.add(-2.0f + 4.0f * (i % 2), -3.0f + 2.0f * (i / 2), 0.6f, 0.2f);
+	return walls;
+}
+
+// every ball pushed out of the walls of the arena in one batch
+static double benchCollideWalls(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n);
+	phys::BallStore store;
+	for (int i = 0; i < n; i++) {
+		store.add(phys::SHOT, balls[i].x, balls[i].y, balls[i].z, balls[i].radius);
+		store.vx[i] = balls[i].vx;
+		store.vz[i] = balls[i].vz;
+	}
+	phys::WallStore walls = makeArena();
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			phys::collideWalls(walls, store.x.data(), store.z.data(), store.vx.data(), store.vz.data(),
+				store.radius.data(), n);
+		}
+		g_sink = store.x[0];
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// every ball swept one step against all walls of the arena
+static double benchSweepWalls(int n, double minTime, long long& iterations)
+{
+	std::vector<phys::Ball> balls = makeBalls(n);
+	phys::WallStore walls = makeArena();
+	const float k = phys::TIME_SCALE * TimeDelta;
+	return measure([&](long long count) {
+		int hits = 0;
+		for (long long it = 0; it < count; it++) {
+			for (int i = 0; i < n; i++) {
+				const phys::Ball& b = balls[i];
+				float t, nx, nz;
+				hits += phys::sweepWalls(walls, b.x, b.z, k * b.vx, k * b.vz, b.radius, t, nx, nz) >= 0;
+			}
+		}
+		g_sink = (float)hits;
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// World::step with n bricks. a game that ends is started over; that is not timed.
+static double benchWorldStep(int n, double minTime, long long& iterations)
+{
+	phys::World level, world;
+	makeWorld(level, n);
+	world = level;
+	return measure([&](long long count) {
+		double excluded = 0.0;
+		for (long long it = 0; it < count; it++) {
+			if (world.state() != phys::World::PLAYING) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				world = level;
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				excluded += elapsed.count();
+			}
+			world.step(TimeDelta);
+		}
+		g_sink = (float)world.cleared();
+		return excluded;
+	}, minTime, iterations);
+}
+
+// World::step with n shots in play among 1000 bricks, swept on all cores
+static double benchWorldShots(int n, double minTime, long long& iterations)
+{
+	static phys::ThreadPool pool;
+	phys::World level, world;
+	makeWorld(level, 1000);
+	// past a hundred shots they shrink, so they cover the same share of the table at
+	// every scale instead of piling up on each other
+	float radius = 0.5f * phys::BALL_RADIUS * std::min(1.0f, std::sqrt(100.0f / n));
+	phys::Ball first = level.ball(level.shot());
+	first.radius = radius;
+	level.setBall(level.shot(), first);
+	srand(1);
+	for (int i = 1; i < n; i++) {
+		int id = level.addBall(phys::SHOT, 5.0f * rand() / RAND_MAX - 2.5f, 5.0f * rand() / RAND_MAX - 4.5f, radius);
+		level.setVelocity(id, 4.0f * rand() / RAND_MAX - 2.0f, 2.0f + 2.0f * rand() / RAND_MAX);
+	}
+	world = level;
+	world.setThreadPool(&pool);
+	return measure([&](long long count) {
+		double excluded = 0.0;
+		for (long long it = 0; it < count; it++) {
+			// restart once half of the shots are lost
+			if (world.state() != phys::World::PLAYING || 2 * world.numShots() < n) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				world = level;
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				excluded += elapsed.count();
+			}
+			world.step(TimeDelta);
+		}
+		g_sink = (float)world.cleared();
+		return excluded;
+	}, minTime, iterations);
+}
+
+// save and restore a world of n bricks, as a rollback does every time
+static double benchSnapshot(int n, double minTime, long long& iterations)
+{
+	phys::World world;
+	makeWorld(world, n);
+	phys::Snapshot snapshot;
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			world.save(snapshot);
+			world.restore(snapshot);
+		}
+		g_sink = (float)snapshot.size();
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// n particles that outlive the benchmark, so every update moves all of them
+static double benchParticles(int n, double minTime, long long& iterations)
+{
+	phys::ParticlePool pool(n);
+	pool.emit(0.0f, 1.0f, 0.0f, 1.0f, 1.0f, 1.0f, n, 0xffff00, phys::PARTICLE_SPEED, 1e30f);
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++)
+			pool.update(TimeDelta);
+		g_sink = pool.y()[0];
+		return 0.0;
+	}, minTime, iterations);
+}
+
+// the aim preview among n bricks, aimed somewhere else every time as while dragging
+// the marker, so the path is worked out again on every iteration
+static double benchPreview(int n, double minTime, long long& iterations)
+{
+	phys::World world;
+	makeWorld(world, n);
+	phys::AimPreview preview;
+	const phys::Ball shot = world.ball(world.shot());
+	return measure([&](long long count) {
+		for (long long it = 0; it < count; it++) {
+			float a = 0.3f + 2.5f * (float)(it % 64) / 64.0f;
+			preview.update(world, shot.x, shot.z, std::cos(a), std::sin(a), shot.radius);
+		}
+		g_sink = (float)preview.numLegs();
+		return 0.0;
+	}, minTime, iterations);
+}
+
+struct Benchmark
+{
+	const char* family;
+	double    (*run)(int n, double minTime, long long& iterations);
+};
+
+const Benchmark Benchmarks[] = {
+	{ "ballUpdate",          benchBallUpdate },
+	{ "integrateBalls",      benchIntegrate },
+	{ "ball.hasIntersected", benchBallIntersect },
+	{ "ball.hitBy",          benchBallHitBy },
+	{ "wall.hitBy",          benchWallHitBy },
+	{ "collideWalls",        benchCollideWalls },
+	{ "sweepWalls",          benchSweepWalls },
+	{ "World.step",          benchWorldStep },
+	{ "World.shots",         benchWorldShots },
+	{ "World.snapshot",      benchSnapshot },
+	{ "particles.update",    benchParticles },
+	{ "preview.update",      benchPreview },
+};
+
+static const char* simdName(void)
+{
+#if defined(PHYS_AVX)
+	return "avx";
+#elif defined(PHYS_SSE2)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+static bool writeJson(const char* path, const std::vector<Result>& results)
+{
+	FILE* fp = strcmp(path, "-") ? fopen(path, "w") : stdout;
+	if (!fp)
+		return false;
+
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+	fprintf(fp, "{\n  \"context\": {\n");
+	fprintf(fp, "    \"date\": \"%s\",\n", date);
+	fprintf(fp, "    \"executable\": \"legoBench\",\n");
+	fprintf(fp, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+	fprintf(fp, "    \"simd\": \"%s\",\n", simdName());
+	fprintf(fp, "    \"real\": \"%s\",\n", phys::REAL_FORMAT ? "q16.16" : "float");
+#if defined(NDEBUG)
+	fprintf(fp, "    \"library_build_type\": \"release\"\n");
+#else
+	fprintf(fp, "    \"library_build_type\": \"debug\"\n");
+#endif
+	fprintf(fp, "  },\n  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result& r = results[i];
+		fprintf(fp, "    {\n");
+		fprintf(fp, "      \"name\": \"%s\",\n", r.name.c_str());
+		fprintf(fp, "      \"family\": \"%s\",\n", r.family.c_str());
+		fprintf(fp, "      \"objects\": %d,\n", r.objects);
+		fprintf(fp, "      \"iterations\": %lld,\n", r.iterations);
+		fprintf(fp, "      \"real_time\": %.3f,\n", r.ns);
+		fprintf(fp, "      \"time_unit\": \"ns\",\n");
+		fprintf(fp, "      \"items_per_second\": %.1f\n", r.objects * 1e9 / r.ns);
+		fprintf(fp, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	return fp == stdout || fclose(fp) == 0;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-filter text] [-json file] [-min_time seconds] [-max_objects n]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* filter = NULL;
+	const char* json = NULL;
+	double minTime = 0.2;
+	int maxObjects = 100000;
+
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (more && !strcmp(argv[i], "-filter")) filter = argv[++i];
+		else if (more && !strcmp(argv[i], "-json")) json = argv[++i];
+		else if (more && !strcmp(argv[i], "-min_time")) minTime = atof(argv[++i]);
+		else if (more && !strcmp(argv[i], "-max_objects")) maxObjects = atoi(argv[++i]);
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// the table goes to stderr when the JSON goes to stdout
+	FILE* out = json && !strcmp(json, "-") ? stderr : stdout;
+	fprintf(out, "%-28s %12s %14s %14s\n", "benchmark", "iterations", "ns/iter", "objects/s");
+
+	std::vector<Result> results;
+	for (size_t b = 0; b < sizeof(Benchmarks) / sizeof(Benchmarks[0]); b++) {
+		for (size_t s = 0; s < sizeof(Scales) / sizeof(Scales[0]); s++) {
+			if (Scales[s] > maxObjects)
+				continue;
+			Result r;
+			r.family = Benchmarks[b].family;
+			r.objects = Scales[s];
+			r.name = r.family + "/" + std::to_string(r.objects);
+			if (filter && r.name.find(filter) == std::string::npos)
+				continue;
+
+			r.ns = Benchmarks[b].run(r.objects, minTime, r.iterations);
+			results.push_back(r);
+			fprintf(out, "%-28s %12lld %14.1f %14.4g\n", r.name.c_str(), r.iterations, r.ns, r.objects * 1e9 / r.ns);
+		}
+	}
+
+	if (json && !writeJson(json, results)) {
+		fprintf(stderr, "can not write %s\n", json);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoFixed.h
+//
+// Desc: The scalar the physics core decides contacts in. Real is float, or with
+//       PHYS_FIXED (cmake -DLEGO_FIXED=ON) the Q16.16 fixed point type Fixed: integer
+//       arithmetic only, square roots included, so a game plays out bit for bit the
+//       same on any compiler and CPU. The state stays in float arrays either way; in
+//       fixed point every value stored there is a multiple of 1/65536, which a float
+//       holds exactly below 256.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoFixedH__
+#define __legoFixedH__
+
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+namespace phys
+{
+	//
+	// Fixed: 16 integer bits and 16 fraction bits. products and quotients go through
+	// 64 bits; products are rounded down, quotients towards zero, and a quotient that
+	// does not fit saturates.
+	//
+
+	struct Fixed
+	{
+		int raw;
+
+		Fixed() : raw(0) {}
+		// f to the nearest 1/65536; |f| must be below 32768. the physics converts only
+		// values that came in through quantize(), so it skips the check of saturated().
+		explicit Fixed(float f) : raw((int)(f * 65536.0f + std::copysign(0.5f, f))) {}
+
+		// the same for any float, e.g. one read from a level file: past +-32768 it
+		// saturates like a quotient, and NaN is 0
+		static Fixed saturated(float f)
+		{
+			const float limit = 32767.998046875f;    // the float nearest 32768 below it
+			if (!(f == f))
+				return Fixed();
+			return Fixed(f < -limit ? -limit : (f > limit ? limit : f));
+		}
+
+		static Fixed fromRaw(int raw) { Fixed f; f.raw = raw; return f; }
+		static Fixed max(void) { return fromRaw(INT_MAX); }
+
+		Fixed operator-() const { return fromRaw(-raw); }
+		Fixed operator+(Fixed b) const { return fromRaw(raw + b.raw); }
+		Fixed operator-(Fixed b) const { return fromRaw(raw - b.raw); }
+		Fixed operator*(Fixed b) const { return fromRaw((int)(((long long)raw * b.raw) >> 16)); }
+		Fixed operator/(Fixed b) const
+		{
+			if (b.raw == 0)
+				return raw < 0 ? -max() : max();
+			const long long q = (long long)raw * 65536 / b.raw;
+			return fromRaw(q > INT_MAX ? INT_MAX : (q < -INT_MAX ? -INT_MAX : (int)q));
+		}
+
+		Fixed& operator+=(Fixed b) { raw += b.raw; return *this; }
+		Fixed& operator-=(Fixed b) { raw -= b.raw; return *this; }
+		Fixed& operator*=(Fixed b) { return *this = *this * b; }
+		Fixed& operator/=(Fixed b) { return *this = *this / b; }
+
+		bool operator==(Fixed b) const { return raw == b.raw; }
+		bool operator!=(Fixed b) const { return raw != b.raw; }
+		bool operator< (Fixed b) const { return raw <  b.raw; }
+		bool operator<=(Fixed b) const { return raw <= b.raw; }
+		bool operator> (Fixed b) const { return raw >  b.raw; }
+		bool operator>=(Fixed b) const { return raw >= b.raw; }
+
+	};
+
+	// floor(sqrt(n)) for n < 2^63, exactly: the double root is only a first guess, off by
+	// one at most, so one step either way fixes it without a branch
+	inline unsigned long long isqrt(unsigned long long n)
+	{
+		unsigned long long r = (unsigned long long)std::sqrt((double)(long long)n);
+		r -= r * r > n;
+		r += (r + 1) * (r + 1) <= n;
+		return r;
+	}
+
+	// is g * g * b <= a * 2^32? for g <= 2^31, in 128 bits made of 32 bit halves
+	inline bool rootAtMost(unsigned long long g, unsigned long long a, unsigned long long b)
+	{
+		const unsigned long long m = g * g;
+		const unsigned long long m0 = m & 0xffffffffu, m1 = m >> 32, b0 = b & 0xffffffffu, b1 = b >> 32;
+		const unsigned long long p00 = m0 * b0, p01 = m0 * b1, p10 = m1 * b0, p11 = m1 * b1;
+		const unsigned long long mid = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+		const unsigned long long hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+		const unsigned long long lo = (mid << 32) | (p00 & 0xffffffffu);
+		return hi < (a >> 32) || (hi == (a >> 32) && lo <= (a << 32));
+	}
+
+	// floor(65536 * sqrt(a / b)) for b > 0, saturated like a quotient. the double result
+	// is off by far less than 2^-16, so its floor is exact unless it lies that close to
+	// a whole number; only then is it checked in integers.
+	inline int rootOfRatio(unsigned long long a, unsigned long long b)
+	{
+		const double k = std::sqrt((double)a / (double)b) * 65536.0;
+		long long g = INT_MAX;
+		if (k < (double)INT_MAX) {
+			const long long fine = (long long)(k * 65536.0);
+			g = fine >> 16;
+			if ((unsigned int)((fine & 0xffff) - 1) < 0xfffeu)
+				return (int)g;
+		}
+		if (!rootAtMost(g, a, b))
+			g--;
+		else if (g < INT_MAX && rootAtMost(g + 1, a, b))
+			g++;
+		return (int)g;
+	}
+
+	//
+	// The same operations on float and Fixed, for code written once for both
+	//
+
+	inline float toFloat(float f) { return f; }
+	inline float toFloat(Fixed f) { return f.raw * (1.0f / 65536.0f); }
+
+	inline float sqrtOf(float f) { return std::sqrt(f); }
+	inline Fixed sqrtOf(Fixed f)
+	{
+		return Fixed::fromRaw(f.raw > 0 ? (int)isqrt((unsigned long long)f.raw << 16) : 0);
+	}
+
+	// length of (x,z). in fixed point from the 64 bit sum of squares, so a short vector
+	// normalizes as well as a long one
+	inline float norm(float x, float z) { return std::sqrt(x * x + z * z); }
+	inline unsigned long long normSquared(Fixed x, Fixed z)
+	{
+		return (unsigned long long)((long long)x.raw * x.raw) + (unsigned long long)((long long)z.raw * z.raw);
+	}
+	inline Fixed norm(Fixed x, Fixed z)
+	{
+		unsigned long long r = isqrt(normSquared(x, z));
+		return Fixed::fromRaw(r > INT_MAX ? INT_MAX : (int)r);
+	}
+
+	inline float largest(float) { return FLT_MAX; }
+	inline Fixed largest(Fixed) { return Fixed::max(); }
+
+	inline float sinOf(float a) { return std::sin(a); }
+	inline float cosOf(float a) { return std::cos(a); }
+
+	// Taylor series to a^11 on [-pi/2, pi/2], which the argument is folded into
+	inline Fixed sinOf(Fixed a)
+	{
+		const int PI = 205887, TWO_PI = 411775, HALF_PI = 102944;   // in 1/65536
+		int r = a.raw % TWO_PI;
+		if (r > PI)  r -= TWO_PI;
+		if (r < -PI) r += TWO_PI;
+		if (r > HALF_PI)  r = PI - r;
+		if (r < -HALF_PI) r = -PI - r;
+		const Fixed x = Fixed::fromRaw(r), x2 = x * x, one = Fixed(1.0f);
+		Fixed s = one;
+		const int divisors[5] = { 110, 72, 42, 20, 6 };
+		for (int i = 0; i < 5; i++)
+			s = one - Fixed::fromRaw((x2 * s).raw / divisors[i]);
+		return x * s;
+	}
+
+	inline Fixed cosOf(Fixed a) { return sinOf(a + Fixed::fromRaw(102944)); }   // sin(a + pi/2)
+
+	//
+	// Real
+	//
+
+#if defined(PHYS_FIXED)
+	typedef Fixed Real;
+	// kept in replays, which only play back in a build of the same format. 2 since deflect()
+	// rounds |v| / |d| once, which moves fixed point games off the ones recorded with 1
+	const unsigned int REAL_FORMAT = 2;
+#else
+	typedef float Real;
+	const unsigned int REAL_FORMAT = 0;
+#endif
+
+	// f rounded to what Real holds. everything the physics is given goes through here,
+	// so in fixed point a value out of range saturates here instead of overflowing later.
+#if defined(PHYS_FIXED)
+	inline float quantize(float f) { return toFloat(Fixed::saturated(f)); }
+#else
+	inline float quantize(float f) { return f; }
+#endif
+}
+
+#endif // __legoFixedH__
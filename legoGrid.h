@@ -0,0 +1,174 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoGrid.h
+//
+// Desc: Uniform grid broad phase for ball / ball collision. Ball centers are bucketed by
+//       cell with a counting sort, so building is O(n) and a query only visits the few
+//       cells around a ball instead of every other ball, or those along its path.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoGridH__
+#define __legoGridH__
+
+#include <cmath>
+#include <vector>
+
+namespace phys
+{
+	class SpatialGrid
+	{
+	public:
+		SpatialGrid() : m_minX(0.0f), m_minZ(0.0f), m_invCell(1.0f), m_cols(0), m_rows(0), m_maxRadius(0.0f) {}
+
+		// cover [minX,maxX] x [minZ,maxZ] with square cells of the given size
+		void init(float minX, float minZ, float maxX, float maxZ, float cellSize)
+		{
+			m_minX = minX;
+			m_minZ = minZ;
+			m_invCell = 1.0f / cellSize;
+			m_cols = (int)std::ceil((maxX - minX) * m_invCell);
+			m_rows = (int)std::ceil((maxZ - minZ) * m_invCell);
+			if (m_cols < 1) m_cols = 1;
+			if (m_rows < 1) m_rows = 1;
+			m_cellStart.assign(m_cols * m_rows + 1, 0);
+			m_items.clear();
+		}
+
+		// insert every ball i with use[i] != 0. balls whose center is off the grid are
+		// left out; nothing on the table can touch them.
+		template<class Pred>
+		void build(const float* x, const float* z, const float* radius, int n, Pred use)
+		{
+			const int numCells = m_cols * m_rows;
+			m_cellOf.resize(n);
+			m_cellStart.assign(numCells + 1, 0);
+			m_maxRadius = 0.0f;
+
+			for (int i = 0; i < n; i++) {
+				int c = use(i) ? cellIndex(x[i], z[i]) : -1;
+				m_cellOf[i] = c;
+				if (c < 0)
+					continue;
+				m_cellStart[c + 1]++;
+				if (radius[i] > m_maxRadius)
+					m_maxRadius = radius[i];
+			}
+			for (int c = 0; c < numCells; c++)
+				m_cellStart[c + 1] += m_cellStart[c];
+
+			m_items.resize(m_cellStart[numCells]);
+			m_fill.assign(m_cellStart.begin(), m_cellStart.end() - 1);
+			for (int i = 0; i < n; i++) {
+				if (m_cellOf[i] >= 0)
+					m_items[m_fill[m_cellOf[i]]++] = i;
+			}
+		}
+
+		// call f(id) for every inserted ball that may touch a circle of radius r at (x, z)
+		template<class F>
+		void query(float x, float z, float r, F f) const
+		{
+			if (m_items.empty())
+				return;
+			float reach = r + m_maxRadius;
+			int c0 = clampCol(cellCoord(x - reach, m_minX)), c1 = clampCol(cellCoord(x + reach, m_minX));
+			int r0 = clampRow(cellCoord(z - reach, m_minZ)), r1 = clampRow(cellCoord(z + reach, m_minZ));
+			for (int row = r0; row <= r1; row++) {
+				for (int col = c0; col <= c1; col++) {
+					int c = row * m_cols + col;
+					for (int k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+						f(m_items[k]);
+				}
+			}
+		}
+
+		// call f(id) for every inserted ball that may touch a circle of radius r moving from
+		// (x, z) by (dx, dz). visits only the cells along the path, row by row, rather than
+		// the square around the whole move, which is mostly empty for a long diagonal one.
+		template<class F>
+		void queryPath(float x, float z, float dx, float dz, float r, F f) const
+		{
+			if (m_items.empty())
+				return;
+			const float reach = r + m_maxRadius;
+			const float cell = 1.0f / m_invCell;
+			float z0 = dz < 0.0f ? z + dz : z, z1 = dz < 0.0f ? z : z + dz;
+			int r0 = clampRow(cellCoord(z0 - reach, m_minZ)), r1 = clampRow(cellCoord(z1 + reach, m_minZ));
+			for (int row = r0; row <= r1; row++) {
+				// the part of the path within reach of the centers of this row
+				float t0 = 0.0f, t1 = 1.0f;
+				if (dz != 0.0f) {
+					float lo = m_minZ + row * cell - reach, hi = lo + cell + 2 * reach;
+					float a = (lo - z) / dz, b = (hi - z) / dz;
+					if (a > b) { float t = a; a = b; b = t; }
+					if (a > t0) t0 = a;
+					if (b < t1) t1 = b;
+					if (t0 > t1)
+						continue;
+				}
+				float xa = x + t0 * dx, xb = x + t1 * dx;
+				if (xa > xb) { float t = xa; xa = xb; xb = t; }
+				int c0 = clampCol(cellCoord(xa - reach, m_minX)), c1 = clampCol(cellCoord(xb + reach, m_minX));
+				for (int k = m_cellStart[row * m_cols + c0]; k < m_cellStart[row * m_cols + c1 + 1]; k++)
+					f(m_items[k]);
+			}
+		}
+
+		// call f(i, j) once for every pair of inserted balls in the same or adjacent
+		// cells. exact when the cell size is at least twice the largest radius.
+		template<class F>
+		void forEachPair(F f) const
+		{
+			static const int NEIGHBOR[4][2] = { {1,0}, {-1,1}, {0,1}, {1,1} };
+			for (int row = 0; row < m_rows; row++) {
+				for (int col = 0; col < m_cols; col++) {
+					int c = row * m_cols + col;
+					int b = m_cellStart[c], e = m_cellStart[c + 1];
+					for (int i = b; i < e; i++)
+						for (int j = i + 1; j < e; j++)
+							f(m_items[i], m_items[j]);
+
+					for (int k = 0; k < 4; k++) {
+						int nc = col + NEIGHBOR[k][0], nr = row + NEIGHBOR[k][1];
+						if (nc < 0 || nc >= m_cols || nr >= m_rows)
+							continue;
+						int n = nr * m_cols + nc;
+						for (int i = b; i < e; i++)
+							for (int j = m_cellStart[n]; j < m_cellStart[n + 1]; j++)
+								f(m_items[i], m_items[j]);
+					}
+				}
+			}
+		}
+
+		int numCells(void) const { return m_cols * m_rows; }
+		int size(void) const { return (int)m_items.size(); }
+
+	private:
+		int cellCoord(float v, float origin) const { return (int)std::floor((v - origin) * m_invCell); }
+		int clampCol(int c) const { return c < 0 ? 0 : (c >= m_cols ? m_cols - 1 : c); }
+		int clampRow(int r) const { return r < 0 ? 0 : (r >= m_rows ? m_rows - 1 : r); }
+
+		int cellIndex(float x, float z) const
+		{
+			int col = cellCoord(x, m_minX);
+			int row = cellCoord(z, m_minZ);
+			if (col < 0 || col >= m_cols || row < 0 || row >= m_rows)
+				return -1;
+			return row * m_cols + col;
+		}
+
+		float m_minX, m_minZ;
+		float m_invCell;
+		int   m_cols, m_rows;
+		float m_maxRadius;
+
+		std::vector<int> m_cellStart;   // items of cell c are m_items[m_cellStart[c] .. m_cellStart[c+1])
+		std::vector<int> m_items;
+		std::vector<int> m_cellOf;
+		std::vector<int> m_fill;
+	};
+}
+
+#endif // __legoGridH__
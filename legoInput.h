@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoInput.h
+//
+// Desc: Input from the window thread to the simulation. The window procedure only pushes
+//       requests into a lock-free single producer / single consumer ring; the simulation
+//       takes them out at the start of a tick and applies them through the replay, so
+//       the world is only ever touched by the thread that steps it.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoInputH__
+#define __legoInputH__
+
+#include "legoReplay.h"
+#include <atomic>
+
+namespace phys
+{
+	//
+	// SpscQueue: a ring of N - 1 usable entries, N a power of two. push() may only be
+	// called from one thread and pop() from one other; neither blocks or allocates.
+	//
+
+	template<class T, unsigned int N>
+	class SpscQueue
+	{
+	public:
+		SpscQueue() : m_head(0), m_tail(0) {}
+
+		// false if the ring is full; the item is dropped
+		bool push(const T& item)
+		{
+			const unsigned int tail = m_tail.load(std::memory_order_relaxed);
+			const unsigned int next = (tail + 1) & (N - 1);
+			if (next == m_head.load(std::memory_order_acquire))
+				return false;
+			m_items[tail] = item;
+			m_tail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		// false if the ring is empty
+		bool pop(T& item)
+		{
+			const unsigned int head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire))
+				return false;
+			item = m_items[head];
+			m_head.store((head + 1) & (N - 1), std::memory_order_release);
+			return true;
+		}
+
+	private:
+		static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+		// head and tail on cache lines of their own, so the two threads do not share one
+		std::atomic<unsigned int> m_head;
+		char                      m_pad0[64 - sizeof(std::atomic<unsigned int>)];
+		std::atomic<unsigned int> m_tail;
+		char                      m_pad1[64 - sizeof(std::atomic<unsigned int>)];
+		T                         m_items[N];
+	};
+
+	//
+	// InputQueue
+	//
+
+	// requests that go to the History or the level rather than to the world; they are
+	// not recorded
+	enum RequestType
+	{
+		REQUEST_UNDO = 16,  // value: ticks to go back
+		REQUEST_RETRY,      // back to before the shot
+		REQUEST_RELOAD      // start the level over; see apply()
+	};
+
+	// what the window asks for: an InputType or RequestType and its value. the window
+	// does not know where the paddle and marker are, so INPUT_PADDLE and INPUT_MARKER
+	// carry an offset in x here; apply() turns it into the position the replay records.
+	struct InputRequest
+	{
+		int   type;
+		float value;
+	};
+
+	class InputQueue
+	{
+	public:
+		InputQueue() : m_dropped(0) {}
+
+		// window thread. a request that does not fit is counted in dropped()
+		void push(int type, float value = 0.0f)
+		{
+			InputRequest r;
+			r.type  = type;
+			r.value = value;
+			if (!m_ring.push(r))
+				m_dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// simulation thread, before a step: apply every request so far in order. undo
+		// and retry need the history of the game and are ignored without one. returns
+		// true on a reload: the requests after it were meant for the level that goes
+		// away and are dropped, and the caller sets up the level again before it steps.
+		bool apply(World& world, Replay& replay, History* history = 0)
+		{
+			InputRequest r;
+			while (m_ring.pop(r)) {
+				int id = -1;
+				if (r.type == INPUT_PADDLE) id = world.paddle();
+				if (r.type == INPUT_MARKER) id = world.marker();
+				if (r.type == REQUEST_RELOAD) {
+					clear();
+					return true;
+				}
+				else if (r.type == REQUEST_UNDO) {
+					if (history)
+						history->undo(world, replay, (unsigned int)r.value);
+				}
+				else if (r.type == REQUEST_RETRY) {
+					if (history)
+						history->retry(world, replay);
+				}
+				else if (r.type == INPUT_PADDLE || r.type == INPUT_MARKER) {
+					if (id >= 0)
+						replay.input(world, r.type, world.ball(id).x + r.value);
+				}
+				else
+					replay.input(world, r.type, r.value);
+			}
+			return false;
+		}
+
+		// simulation thread: drop every request so far
+		void clear(void)
+		{
+			InputRequest r;
+			while (m_ring.pop(r))
+				;
+		}
+
+		unsigned int dropped(void) const { return m_dropped.load(std::memory_order_relaxed); }
+
+	private:
+		SpscQueue<InputRequest, 256> m_ring;
+		std::atomic<unsigned int>    m_dropped;
+	};
+}
+
+#endif // __legoInputH__
@@ -0,0 +1,352 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoLevel.h
+//
+// Desc: Level files. Levels are written as text (.lvl) and compiled to a binary form
+//       (.lvb) whose ball arrays are laid out exactly like phys::BallStore, so loading
+//       one maps the file copy-on-write and hands the arrays to the world in place.
+//
+//       Text form, one item per line, '#' starts a comment:
+//
+//           brick  x z [size | width depth]
+//           paddle x z
+//           shot   x z
+//           marker x z
+//           wall   x z width depth
+//           floor  x z width depth
+//
+//       A brick is BRICK_WIDTH x BRICK_DEPTH unless given a size (a square) or both sides.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoLevelH__
+#define __legoLevelH__
+
+#include "legoPhysics.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace phys
+{
+	//
+	// Level description, as read from text
+	//
+
+	struct LevelBall
+	{
+		int   kind;
+		float x, z;
+		float radius;
+		float width, depth;     // of a brick; 0 for round balls
+	};
+
+	struct Level
+	{
+		std::vector<LevelBall> balls;
+		std::vector<Wall>      walls;
+	};
+
+	// parse the text form. on failure 'error' tells the line and the problem.
+	inline bool parseLevel(const char* path, Level& level, std::string& error)
+	{
+		level.balls.clear();
+		level.walls.clear();
+
+		FILE* fp = fopen(path, "r");
+		if (!fp) {
+			error = std::string("can not open ") + path;
+			return false;
+		}
+
+		char line[256];
+		int lineNo = 0;
+		bool ok = true;
+		while (ok && fgets(line, sizeof(line), fp)) {
+			lineNo++;
+			char* hash = strchr(line, '#');
+			if (hash)
+				*hash = '\0';
+
+			char word[16];
+			float v[4];
+			int n = sscanf(line, "%15s %f %f %f %f", word, &v[0], &v[1], &v[2], &v[3]);
+			if (n <= 0)
+				continue;
+
+			LevelBall b;
+			b.x = v[0]; b.z = v[1];
+			b.radius = BALL_RADIUS;
+			b.width = b.depth = 0.0f;
+			b.kind = -1;
+			if (!strcmp(word, "brick")) {
+				b.kind = BRICK;
+				b.width = n == 3 ? BRICK_WIDTH : v[2];
+				b.depth = n == 3 ? BRICK_DEPTH : (n == 4 ? v[2] : v[3]);
+				b.radius = brickRadius(b.width, b.depth);
+				if (b.width <= 0.0f || b.depth <= 0.0f)
+					b.radius = 0.0f;
+			}
+			else if (!strcmp(word, "paddle")) b.kind = PADDLE;
+			else if (!strcmp(word, "shot"))   b.kind = SHOT;
+			else if (!strcmp(word, "marker")) b.kind = MARKER;
+
+			if (b.kind >= 0 && n >= 3 && b.radius > 0.0f) {
+				level.balls.push_back(b);
+			}
+			else if ((!strcmp(word, "wall") || !strcmp(word, "floor")) && n == 5) {
+				Wall w;
+				w.x = v[0]; w.z = v[1];
+				w.width = v[2]; w.depth = v[3];
+				w.kind = strcmp(word, "floor") ? SOLID_WALL : FLOOR_WALL;
+				level.walls.push_back(w);
+			}
+			else {
+				char where[16];
+				sprintf(where, ":%d: ", lineNo);
+				error = std::string(path) + where + "can not read '" + word + "'";
+				ok = false;
+			}
+		}
+		fclose(fp);
+		return ok;
+	}
+
+	inline void buildWorld(World& world, const Level& level)
+	{
+		world.clear();
+		for (size_t i = 0; i < level.balls.size(); i++) {
+			const LevelBall& b = level.balls[i];
+			if (b.kind == BRICK)
+				world.addBrick(b.x, b.z, b.width, b.depth);
+			else
+				world.addBall(b.kind, b.x, b.z, b.radius);
+		}
+		for (size_t i = 0; i < level.walls.size(); i++) {
+			const Wall& w = level.walls[i];
+			world.addWall(w.x, w.z, w.width, w.depth, w.kind);
+		}
+	}
+
+	//
+	// Binary form: a header, then the nine ball arrays of BallStore and the walls, each
+	// starting on a SIMD_ALIGN boundary of the file. little endian. a wall is x, z,
+	// width, depth and kind, 4 bytes each, whatever the layout of struct Wall.
+	//
+
+	struct LevelHeader
+	{
+		char         magic[4];      // "LGLV"
+		unsigned int version;
+		unsigned int numBalls;
+		unsigned int numWalls;
+		unsigned int ballArray[9];  // file offsets of x, y, z, vx, vz, radius, width, depth, kind
+		unsigned int wallArray;     // file offset of the walls
+	};
+
+	const unsigned int LEVEL_VERSION = 2;
+	const unsigned int WALL_BYTES    = 20;
+
+	inline bool writeLevel(const Level& level, const char* path)
+	{
+		const unsigned int n = (unsigned int)level.balls.size();
+		const unsigned int arrayBytes = ((n * 4 + SIMD_ALIGN - 1) / SIMD_ALIGN) * SIMD_ALIGN;
+
+		LevelHeader h;
+		memcpy(h.magic, "LGLV", 4);
+		h.version = LEVEL_VERSION;
+		h.numBalls = n;
+		h.numWalls = (unsigned int)level.walls.size();
+		unsigned int offset = SIMD_ALIGN;
+		for (int a = 0; a < 9; a++, offset += arrayBytes)
+			h.ballArray[a] = offset;
+		h.wallArray = offset;
+
+		std::vector<char> file(offset + h.numWalls * WALL_BYTES, 0);
+		memcpy(&file[0], &h, sizeof(h));
+		for (unsigned int i = 0; i < n; i++) {
+			const LevelBall& b = level.balls[i];
+			// where World::addBall and addBrick put them
+			float y = b.kind == BRICK ? BRICK_HEIGHT / 2 : b.radius;
+			memcpy(&file[h.ballArray[0] + i * 4], &b.x, 4);
+			memcpy(&file[h.ballArray[1] + i * 4], &y, 4);
+			memcpy(&file[h.ballArray[2] + i * 4], &b.z, 4);
+			// ballArray[3] and [4], the velocities, stay zero
+			memcpy(&file[h.ballArray[5] + i * 4], &b.radius, 4);
+			memcpy(&file[h.ballArray[6] + i * 4], &b.width, 4);
+			memcpy(&file[h.ballArray[7] + i * 4], &b.depth, 4);
+			memcpy(&file[h.ballArray[8] + i * 4], &b.kind, 4);
+		}
+		for (unsigned int i = 0; i < h.numWalls; i++) {
+			const Wall& w = level.walls[i];
+			char* p = &file[h.wallArray + i * WALL_BYTES];
+			memcpy(p, &w.x, 4);
+			memcpy(p + 4, &w.z, 4);
+			memcpy(p + 8, &w.width, 4);
+			memcpy(p + 12, &w.depth, 4);
+			memcpy(p + 16, &w.kind, 4);
+		}
+
+		FILE* fp = fopen(path, "wb");
+		if (!fp)
+			return false;
+		bool ok = fwrite(&file[0], file.size(), 1, fp) == 1;
+		return fclose(fp) == 0 && ok;
+	}
+
+	//
+	// MappedFile: a private, copy-on-write mapping of a whole file. Writes go to the
+	// process' own copy of the touched pages, never back to the file.
+	//
+
+	class MappedFile
+	{
+	public:
+		MappedFile() : m_data(0), m_size(0) {}
+		~MappedFile() { close(); }
+
+		bool open(const char* path)
+		{
+			close();
+#if defined(_WIN32)
+			HANDLE file = ::CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER size;
+			HANDLE mapping = 0;
+			if (::GetFileSizeEx(file, &size) && size.QuadPart > 0)
+				mapping = ::CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+			::CloseHandle(file);
+			if (!mapping)
+				return false;
+			m_data = ::MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+			::CloseHandle(mapping);
+			m_size = (size_t)size.QuadPart;
+#else
+			int fd = ::open(path, O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			void* p = MAP_FAILED;
+			if (fstat(fd, &st) == 0 && st.st_size > 0)
+				p = mmap(0, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (p == MAP_FAILED)
+				return false;
+			m_data = p;
+			m_size = (size_t)st.st_size;
+#endif
+			return m_data != 0;
+		}
+
+		void close(void)
+		{
+			if (!m_data)
+				return;
+#if defined(_WIN32)
+			::UnmapViewOfFile(m_data);
+#else
+			munmap(m_data, m_size);
+#endif
+			m_data = 0;
+			m_size = 0;
+		}
+
+		char*  data(void) const { return (char*)m_data; }
+		size_t size(void) const { return m_size; }
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		void*  m_data;
+		size_t m_size;
+	};
+
+	// map a compiled level and let the world use its ball arrays in place
+	inline bool loadLevelBinary(World& world, const char* path, std::string& error)
+	{
+		std::shared_ptr<MappedFile> file(new MappedFile);
+		if (!file->open(path)) {
+			error = std::string("can not map ") + path;
+			return false;
+		}
+
+		LevelHeader h;
+		bool ok = file->size() >= sizeof(h);
+		if (ok) {
+			memcpy(&h, file->data(), sizeof(h));
+			ok = !memcmp(h.magic, "LGLV", 4) && h.version == LEVEL_VERSION;
+		}
+		for (int a = 0; ok && a < 9; a++) {
+			ok = h.ballArray[a] % SIMD_ALIGN == 0
+				&& (size_t)h.ballArray[a] + (size_t)h.numBalls * 4 <= file->size();
+		}
+		ok = ok && (size_t)h.wallArray + (size_t)h.numWalls * WALL_BYTES <= file->size();
+		if (!ok) {
+			error = std::string(path) + ": not a level file of this version";
+			return false;
+		}
+
+		// the kinds index tables (the colors of the game), so a damaged file must not
+		// get any other through
+		char* base = file->data();
+		for (unsigned int i = 0; i < h.numBalls; i++) {
+			int kind;
+			memcpy(&kind, base + h.ballArray[8] + i * 4, 4);
+			ok = ok && kind >= BRICK && kind <= MARKER;
+		}
+		std::vector<Wall> walls(h.numWalls);
+		for (unsigned int i = 0; i < h.numWalls; i++) {
+			const char* p = base + h.wallArray + i * WALL_BYTES;
+			Wall& w = walls[i];
+			memcpy(&w.x, p, 4);
+			memcpy(&w.z, p + 4, 4);
+			memcpy(&w.width, p + 8, 4);
+			memcpy(&w.depth, p + 12, 4);
+			memcpy(&w.kind, p + 16, 4);
+			ok = ok && (w.kind == SOLID_WALL || w.kind == FLOOR_WALL);
+		}
+		if (!ok) {
+			error = std::string(path) + ": damaged level file";
+			return false;
+		}
+
+		world.clear();
+		for (unsigned int i = 0; i < h.numWalls; i++)
+			world.addWall(walls[i].x, walls[i].z, walls[i].width, walls[i].depth, walls[i].kind);
+
+		world.adoptBalls((int)h.numBalls,
+			(float*)(base + h.ballArray[0]), (float*)(base + h.ballArray[1]), (float*)(base + h.ballArray[2]),
+			(float*)(base + h.ballArray[3]), (float*)(base + h.ballArray[4]), (float*)(base + h.ballArray[5]),
+			(float*)(base + h.ballArray[6]), (float*)(base + h.ballArray[7]), (int*)(base + h.ballArray[8]), file);
+		return true;
+	}
+
+	// load a level file: .lvb is mapped, anything else is parsed as text
+	inline bool loadLevel(World& world, const char* path, std::string& error)
+	{
+		size_t len = strlen(path);
+		if (len > 4 && !strcmp(path + len - 4, ".lvb"))
+			return loadLevelBinary(world, path, error);
+
+		Level level;
+		if (!parseLevel(path, level, error))
+			return false;
+		buildWorld(world, level);
+		return true;
+	}
+}
+
+#endif // __legoLevelH__
@@ -0,0 +1,48 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoLevelc.cpp
+//
+// Desc: Level compiler. Turns the text form of a level (see legoLevel.h) into
+//       the binary form the game maps at load time.
+//
+//       usage: legoLevelc level.lvl [level.lvb]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoLevel.h"
+#include <cstdio>
+#include <string>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s level.lvl [level.lvb]\n", argv[0]);
+		return 1;
+	}
+
+	std::string out;
+	if (argc == 3) {
+		out = argv[2];
+	}
+	else {
+		out = argv[1];
+		size_t dot = out.rfind('.');
+		if (dot != std::string::npos && out.find_first_of("/\\", dot) == std::string::npos)
+			out.erase(dot);
+		out += ".lvb";
+	}
+
+	phys::Level level;
+	std::string error;
+	if (!phys::parseLevel(argv[1], level, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	if (!phys::writeLevel(level, out.c_str())) {
+		fprintf(stderr, "can not write %s\n", out.c_str());
+		return 1;
+	}
+
+	printf("%s: %d balls, %d walls\n", out.c_str(), (int)level.balls.size(), (int)level.walls.size());
+	return 0;
+}
@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoMath.h
+//
+// Desc: Vectors, matrices and planes for everything that draws: the renderers of
+//       legoRender.h and legoRaster.h, and CSphere, CWall, CLight and the bounding
+//       volumes of d3dUtility.h in the game. Plain structs that construct at compile
+//       time; the matrix products run four lanes at a time with SSE or NEON where there
+//       is one, and give the same results as the scalar code either way. No Direct3D
+//       dependency.
+//
+//       Conventions are those of Direct3D 9: left-handed coordinates, row vectors
+//       (v * M), Matrix laid out like D3DMATRIX.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoMathH__
+#define __legoMathH__
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RENDER_SSE 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define RENDER_NEON 1
+#endif
+
+namespace render
+{
+	//
+	// Vec3
+	//
+
+	struct Vec3
+	{
+		float x, y, z;
+	};
+
+	inline constexpr Vec3 vec3(float x, float y, float z) { return Vec3{ x, y, z }; }
+	inline constexpr Vec3 operator+(const Vec3& a, const Vec3& b) { return vec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+	inline constexpr Vec3 operator-(const Vec3& a, const Vec3& b) { return vec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+	inline constexpr Vec3 operator*(const Vec3& a, float s) { return vec3(a.x * s, a.y * s, a.z * s); }
+	inline constexpr float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline constexpr Vec3 cross(const Vec3& a, const Vec3& b)
+	{
+		return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+	inline float length(const Vec3& a) { return std::sqrt(dot(a, a)); }
+	inline Vec3 normalize(const Vec3& a)
+	{
+		float len = length(a);
+		return len > 0.0f ? a * (1.0f / len) : a;
+	}
+
+	// per component, as D3DXVec3Minimize and D3DXVec3Maximize
+	inline constexpr Vec3 minimize(const Vec3& a, const Vec3& b)
+	{
+		return vec3(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
+	}
+	inline constexpr Vec3 maximize(const Vec3& a, const Vec3& b)
+	{
+		return vec3(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
+	}
+
+	//
+	// Vec4, also a plane ax + by + cz + d = 0 as (a, b, c, d)
+	//
+
+	struct Vec4
+	{
+		float x, y, z, w;
+	};
+
+	inline constexpr Vec4 vec4(float x, float y, float z, float w) { return Vec4{ x, y, z, w }; }
+	inline constexpr Vec4 vec4(const Vec3& v, float w) { return Vec4{ v.x, v.y, v.z, w }; }
+	inline constexpr Vec4 operator+(const Vec4& a, const Vec4& b) { return vec4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w); }
+	inline constexpr Vec4 operator-(const Vec4& a, const Vec4& b) { return vec4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w); }
+	inline constexpr Vec4 operator*(const Vec4& a, float s) { return vec4(a.x * s, a.y * s, a.z * s, a.w * s); }
+	inline constexpr float dot(const Vec4& a, const Vec4& b) { return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w; }
+
+	// signed distance of p from a normalized plane, as D3DXPlaneDotCoord
+	inline constexpr float planeDot(const Vec4& plane, const Vec3& p)
+	{
+		return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+	}
+
+	// the plane scaled to a unit normal, as D3DXPlaneNormalize
+	inline Vec4 planeNormalize(const Vec4& plane)
+	{
+		float len = length(vec3(plane.x, plane.y, plane.z));
+		return len > 0.0f ? plane * (1.0f / len) : plane;
+	}
+
+	//
+	// Matrix
+	//
+
+	// 4x4 matrix laid out like D3DMATRIX, so the two can be copied into each other
+	struct Matrix
+	{
+		float m[4][4];
+	};
+
+	inline constexpr Matrix identity(void)
+	{
+		return Matrix{ { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } } };
+	}
+
+	inline constexpr Matrix translation(float x, float y, float z)
+	{
+		return Matrix{ { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { x, y, z, 1 } } };
+	}
+
+	inline constexpr Matrix scaling(float x, float y, float z)
+	{
+		return Matrix{ { { x, 0, 0, 0 }, { 0, y, 0, 0 }, { 0, 0, z, 0 }, { 0, 0, 0, 1 } } };
+	}
+
+	// out = x * row 0 + y * row 1 + z * row 2 + w * row 3 of a, summed in that order in
+	// every lane so that the SIMD and scalar code round alike. every product and
+	// transform below is made of these.
+	inline void combineRows(float x, float y, float z, float w, const Matrix& a, float out[4])
+	{
+#if defined(RENDER_SSE)
+		__m128 r = _mm_mul_ps(_mm_set1_ps(x), _mm_loadu_ps(a.m[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(y), _mm_loadu_ps(a.m[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(z), _mm_loadu_ps(a.m[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(a.m[3])));
+		_mm_storeu_ps(out, r);
+#elif defined(RENDER_NEON)
+		// vmulq / vaddq rather than vmlaq, which may fuse and round once instead of twice
+		float32x4_t r = vmulq_n_f32(vld1q_f32(a.m[0]), x);
+		r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(a.m[1]), y));
+		r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(a.m[2]), z));
+		r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(a.m[3]), w));
+		vst1q_f32(out, r);
+#else
+		for (int j = 0; j < 4; j++)
+			out[j] = x * a.m[0][j] + y * a.m[1][j] + z * a.m[2][j] + w * a.m[3][j];
+#endif
+	}
+
+	inline Matrix operator*(const Matrix& a, const Matrix& b)
+	{
+		Matrix r;
+		for (int i = 0; i < 4; i++)
+			combineRows(a.m[i][0], a.m[i][1], a.m[i][2], a.m[i][3], b, r.m[i]);
+		return r;
+	}
+
+	inline Vec4 transform(const Vec4& v, const Matrix& a)
+	{
+		float p[4];
+		combineRows(v.x, v.y, v.z, v.w, a, p);
+		return vec4(p[0], p[1], p[2], p[3]);
+	}
+
+	// v * M with w = 1, without the divide
+	inline void transform(const Vec3& v, const Matrix& a, float out[4])
+	{
+		combineRows(v.x, v.y, v.z, 1.0f, a, out);
+	}
+
+	// v * M with w = 1, divided by w, as D3DXVec3TransformCoord
+	inline Vec3 transformCoord(const Vec3& v, const Matrix& a)
+	{
+		float p[4];
+		transform(v, a, p);
+		return vec3(p[0], p[1], p[2]) * (1.0f / p[3]);
+	}
+
+	// v * M with w = 0, as D3DXVec3TransformNormal
+	inline Vec3 transformNormal(const Vec3& v, const Matrix& a)
+	{
+		float p[4];
+		combineRows(v.x, v.y, v.z, 0.0f, a, p);
+		return vec3(p[0], p[1], p[2]);
+	}
+
+	// same as D3DXMatrixLookAtLH
+	inline Matrix lookAtLH(const Vec3& eye, const Vec3& at, const Vec3& up)
+	{
+		Vec3 z = normalize(at - eye);
+		Vec3 x = normalize(cross(up, z));
+		Vec3 y = cross(z, x);
+		Matrix r = { { { x.x, y.x, z.x, 0 }, { x.y, y.y, z.y, 0 }, { x.z, y.z, z.z, 0 },
+			{ -dot(x, eye), -dot(y, eye), -dot(z, eye), 1 } } };
+		return r;
+	}
+
+	// same as D3DXMatrixPerspectiveFovLH
+	inline Matrix perspectiveFovLH(float fovY, float aspect, float zn, float zf)
+	{
+		float ys = 1.0f / std::tan(fovY / 2);
+		float xs = ys / aspect;
+		Matrix r = { { { xs, 0, 0, 0 }, { 0, ys, 0, 0 }, { 0, 0, zf / (zf - zn), 1 },
+			{ 0, 0, -zn * zf / (zf - zn), 0 } } };
+		return r;
+	}
+
+	// position of the camera of a view matrix without scaling
+	inline Vec3 eyePosition(const Matrix& view)
+	{
+		const float (*m)[4] = view.m;
+		Vec3 t = vec3(m[3][0], m[3][1], m[3][2]);
+		return vec3(-(t.x * m[0][0] + t.y * m[0][1] + t.z * m[0][2]),
+			-(t.x * m[1][0] + t.y * m[1][1] + t.z * m[1][2]),
+			-(t.x * m[2][0] + t.y * m[2][1] + t.z * m[2][2]));
+	}
+}
+
+#endif // __legoMathH__
@@ -0,0 +1,214 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoParticles.h
+//
+// Desc: Debris of broken bricks. A fixed pool of particles in structure-of-arrays form,
+//       allocated once: emitting never allocates, and what does not fit is dropped.
+//       update() moves all of them with a SIMD kernel (AVX / SSE2 / scalar) and takes
+//       the dead ones out; the renderer draws the live ones in one call.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoParticlesH__
+#define __legoParticlesH__
+
+#include "legoPhysics.h"
+
+namespace phys
+{
+	const int   PARTICLE_CAPACITY  = 1 << 17;   // live particles at most
+	const int   PARTICLES_PER_HIT  = 300;       // debris of one broken brick
+	const float PARTICLE_GRAVITY   = 4.0f;      // per unit of World::step time, as velocities
+	const float PARTICLE_BOUNCE    = 0.4f;      // speed kept when bouncing off the table
+	const float PARTICLE_SPEED     = 1.5f;
+	const float PARTICLE_LIFE      = 1.5f;
+	const float PARTICLE_SIZE      = 0.04f;     // edge of the square drawn for each
+
+	// v.y -= g * dt, p += v * dt and life -= dt for n particles. a particle below the
+	// table (y < 0) is mirrored back above it and bounces, keeping 'bounce' of its
+	// vertical speed. returns whether any particle's life is up.
+	inline bool integrateParticles(float* x, float* y, float* z, float* vx, float* vy, float* vz,
+		float* life, int n, float dt, float gravity, float bounce)
+	{
+		int i = 0;
+		int dead = 0;
+#if defined(PHYS_AVX)
+		{
+			const __m256 vdt  = _mm256_set1_ps(dt);
+			const __m256 vg   = _mm256_set1_ps(gravity * dt);
+			const __m256 vb   = _mm256_set1_ps(-bounce);
+			const __m256 zero = _mm256_setzero_ps();
+			for (; i + 8 <= n; i += 8) {
+				__m256 py = _mm256_load_ps(y + i);
+				__m256 pvy = _mm256_sub_ps(_mm256_load_ps(vy + i), vg);
+				_mm256_store_ps(x + i, _mm256_add_ps(_mm256_load_ps(x + i), _mm256_mul_ps(vdt, _mm256_load_ps(vx + i))));
+				_mm256_store_ps(z + i, _mm256_add_ps(_mm256_load_ps(z + i), _mm256_mul_ps(vdt, _mm256_load_ps(vz + i))));
+				py = _mm256_add_ps(py, _mm256_mul_ps(vdt, pvy));
+				__m256 below = _mm256_cmp_ps(py, zero, _CMP_LT_OQ);
+				py  = _mm256_blendv_ps(py, _mm256_sub_ps(zero, py), below);
+				pvy = _mm256_blendv_ps(pvy, _mm256_mul_ps(vb, pvy), below);
+				_mm256_store_ps(y + i, py);
+				_mm256_store_ps(vy + i, pvy);
+				__m256 left = _mm256_sub_ps(_mm256_load_ps(life + i), vdt);
+				_mm256_store_ps(life + i, left);
+				dead |= _mm256_movemask_ps(_mm256_cmp_ps(left, zero, _CMP_LE_OQ));
+			}
+		}
+#endif
+#if defined(PHYS_SSE2)
+		{
+			const __m128 vdt  = _mm_set1_ps(dt);
+			const __m128 vg   = _mm_set1_ps(gravity * dt);
+			const __m128 vb   = _mm_set1_ps(-bounce);
+			const __m128 zero = _mm_setzero_ps();
+			for (; i + 4 <= n; i += 4) {
+				__m128 py = _mm_load_ps(y + i);
+				__m128 pvy = _mm_sub_ps(_mm_load_ps(vy + i), vg);
+				_mm_store_ps(x + i, _mm_add_ps(_mm_load_ps(x + i), _mm_mul_ps(vdt, _mm_load_ps(vx + i))));
+				_mm_store_ps(z + i, _mm_add_ps(_mm_load_ps(z + i), _mm_mul_ps(vdt, _mm_load_ps(vz + i))));
+				py = _mm_add_ps(py, _mm_mul_ps(vdt, pvy));
+				// no blend in SSE2: pick with and / andnot
+				__m128 below = _mm_cmplt_ps(py, zero);
+				py  = _mm_or_ps(_mm_andnot_ps(below, py), _mm_and_ps(below, _mm_sub_ps(zero, py)));
+				pvy = _mm_or_ps(_mm_andnot_ps(below, pvy), _mm_and_ps(below, _mm_mul_ps(vb, pvy)));
+				_mm_store_ps(y + i, py);
+				_mm_store_ps(vy + i, pvy);
+				__m128 left = _mm_sub_ps(_mm_load_ps(life + i), vdt);
+				_mm_store_ps(life + i, left);
+				dead |= _mm_movemask_ps(_mm_cmple_ps(left, zero));
+			}
+		}
+#endif
+		for (; i < n; i++) {
+			vy[i] -= gravity * dt;
+			x[i] += dt * vx[i];
+			y[i] += dt * vy[i];
+			z[i] += dt * vz[i];
+			if (y[i] < 0.0f) {
+				y[i] = -y[i];
+				vy[i] *= -bounce;
+			}
+			life[i] -= dt;
+			dead |= life[i] <= 0.0f;
+		}
+		return dead != 0;
+	}
+
+	//
+	// ParticlePool: live particles are kept packed at 0 .. size() - 1, in no order.
+	//
+
+	class ParticlePool
+	{
+	public:
+		explicit ParticlePool(int capacity = PARTICLE_CAPACITY)
+			: m_capacity(capacity > 0 ? capacity : 1), m_size(0), m_seed(0x9e3779b9u)
+		{
+			// rounded up to whole cache lines, like AlignedArray
+			const size_t n = (m_capacity + 15) / 16 * 16;
+			float** arrays[7] = { &m_x, &m_y, &m_z, &m_vx, &m_vy, &m_vz, &m_life };
+			for (int a = 0; a < 7; a++) {
+				*arrays[a] = (float*)alignedAlloc(n * sizeof(float));
+				memset(*arrays[a], 0, n * sizeof(float));
+			}
+			m_rgb = (unsigned int*)alignedAlloc(n * sizeof(unsigned int));
+		}
+
+		~ParticlePool()
+		{
+			float* arrays[7] = { m_x, m_y, m_z, m_vx, m_vy, m_vz, m_life };
+			for (int a = 0; a < 7; a++)
+				alignedFree(arrays[a]);
+			alignedFree(m_rgb);
+		}
+
+		// count particles of color rgb (0x00RRGGBB) at random in the box of half sizes
+		// (hx, hy, hz) around (x, y, z), flying up and out at up to 'speed'. they live for
+		// half to all of 'life', in World::step time. returns how many fit in the pool.
+		int emit(float x, float y, float z, float hx, float hy, float hz, int count,
+			unsigned int rgb, float speed = PARTICLE_SPEED, float life = PARTICLE_LIFE)
+		{
+			if (count > m_capacity - m_size)
+				count = m_capacity - m_size;
+			for (int k = 0; k < count; k++) {
+				const int i = m_size++;
+				m_x[i] = x + hx * random(-1.0f, 1.0f);
+				m_y[i] = y + hy * random(-1.0f, 1.0f);
+				m_z[i] = z + hz * random(-1.0f, 1.0f);
+				m_vx[i] = speed * random(-1.0f, 1.0f);
+				m_vy[i] = speed * random(0.3f, 1.0f);
+				m_vz[i] = speed * random(-1.0f, 1.0f);
+				m_life[i] = life * random(0.5f, 1.0f);
+				m_rgb[i] = rgb;
+			}
+			return count;
+		}
+
+		// the debris of a brick (or of any ball, for its sphere's bounds)
+		int burst(const Ball& brick, unsigned int rgb, int count = PARTICLES_PER_HIT)
+		{
+			const float hx = brick.width > 0.0f ? brick.width / 2 : brick.radius;
+			const float hz = brick.width > 0.0f ? brick.depth / 2 : brick.radius;
+			const float hy = brick.width > 0.0f ? BRICK_HEIGHT / 2 : brick.radius;
+			return emit(brick.x, brick.y, brick.z, hx, hy, hz, count, rgb);
+		}
+
+		// advance by timeDelta as World::step does, then drop the particles whose time is
+		// up. the last live particle fills each hole, so no memory moves but those.
+		void update(float timeDelta)
+		{
+			ScopedTimer timer(PHASE_PARTICLES);
+			if (!integrateParticles(m_x, m_y, m_z, m_vx, m_vy, m_vz, m_life, m_size,
+				TIME_SCALE * timeDelta, PARTICLE_GRAVITY, PARTICLE_BOUNCE))
+				return;
+			for (int i = 0; i < m_size; ) {
+				if (m_life[i] > 0.0f) {
+					i++;
+					continue;
+				}
+				const int last = --m_size;
+				m_x[i] = m_x[last]; m_y[i] = m_y[last]; m_z[i] = m_z[last];
+				m_vx[i] = m_vx[last]; m_vy[i] = m_vy[last]; m_vz[i] = m_vz[last];
+				m_life[i] = m_life[last];
+				m_rgb[i] = m_rgb[last];
+			}
+		}
+
+		void clear(void) { m_size = 0; }
+
+		int size(void)     const { return m_size; }
+		int capacity(void) const { return m_capacity; }
+		const float* x(void) const { return m_x; }
+		const float* y(void) const { return m_y; }
+		const float* z(void) const { return m_z; }
+		const unsigned int* rgb(void) const { return m_rgb; }
+
+	private:
+		ParticlePool(const ParticlePool&);
+		ParticlePool& operator=(const ParticlePool&);
+
+		// uniform in [lo, hi), from a xorshift generator of its own so effects do not
+		// disturb rand()
+		float random(float lo, float hi)
+		{
+			m_seed ^= m_seed << 13;
+			m_seed ^= m_seed >> 17;
+			m_seed ^= m_seed << 5;
+			return lo + (hi - lo) * (float)(m_seed >> 8) * (1.0f / 16777216.0f);
+		}
+
+		int          m_capacity;
+		int          m_size;
+		unsigned int m_seed;
+		float*       m_x;
+		float*       m_y;
+		float*       m_z;
+		float*       m_vx;
+		float*       m_vy;
+		float*       m_vz;
+		float*       m_life;
+		unsigned int* m_rgb;
+	};
+}
+
+#endif // __legoParticlesH__
@@ -0,0 +1,1111 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoPhysics.h
+//
+// Desc: Headless physics core of Virtual Billiard. Holds the ball/wall state of a game
+//       and advances it with step(). No Direct3D dependency, so it also builds on Linux.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoPhysicsH__
+#define __legoPhysicsH__
+
+#include "legoBalls.h"
+#include "legoGrid.h"
+#include "legoProfile.h"
+#include "legoThreads.h"
+#include "legoWalls.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+namespace phys
+{
+	//
+	// Constants
+	//
+	const float BALL_RADIUS  = 0.21f;
+	const float TIME_SCALE   = 3.3f;
+	const float TABLE_HALF_X = 3.0f;    // long walls at x = -3, 3
+	const float TABLE_HALF_Z = 5.0f;    // short walls at z = -5, 5
+	const float LAUNCH_SCALE = 0.3f;    // launch speed per unit of aim distance
+	const int   MAX_CONTACTS = 16;      // contacts resolved per ball and step
+	const float SPLIT_ANGLE  = 0.26f;   // radians between the balls of a multi-ball split
+	const float BRICK_WIDTH  = 0.6f;    // size of a brick unless a level says otherwise
+	const float BRICK_DEPTH  = 0.3f;
+	const float BRICK_HEIGHT = 0.3f;
+	const int   MIN_PARALLEL_SHOTS = 64;    // fewer shots (or shot pairs) are done on one thread
+
+	enum BallKind { BRICK, PADDLE, SHOT, MARKER };
+	enum WallKind { SOLID_WALL, FLOOR_WALL };
+
+	//
+	// State
+	//
+
+	// a brick is a box of width x depth around its center; its radius is that of the
+	// circle around the box. round balls have a width and depth of 0.
+	struct Ball
+	{
+		float x, y, z;
+		float vx, vz;
+		float radius;
+		float width, depth;
+		int   kind;
+	};
+
+	struct Wall
+	{
+		float x, z;
+		float width, depth;
+		int   kind;
+	};
+
+	inline float brickRadius(float width, float depth)
+	{
+		return 0.5f * std::sqrt(width * width + depth * depth);
+	}
+
+	//
+	// Ball / ball. a brick collides as its box (see legoWalls.h), anything else as a circle
+	//
+
+	inline bool isBox(const Ball& b) { return b.width > 0.0f; }
+
+	// do two round balls overlap? (dx,dz) is b's center less a's, for deflect()
+	inline bool circlesOverlap(const Ball& a, const Ball& b, Real& dx, Real& dz)
+	{
+#if defined(PHYS_FIXED)
+		// rule out the balls that are nowhere near in float, with some slack
+		const float fx = b.x - a.x, fz = b.z - a.z, fr = a.radius + b.radius + 1e-3f;
+		if (fx * fx + fz * fz >= fr * fr)
+			return false;
+#endif
+		dx = Real(b.x) - Real(a.x);
+		dz = Real(b.z) - Real(a.z);
+		Real r = Real(a.radius) + Real(b.radius);
+		return dx * dx + dz * dz < r * r;
+	}
+
+	inline bool hasIntersected(const Ball& a, const Ball& b)
+	{
+		if (isBox(a) || isBox(b)) {
+			const Ball& box = isBox(a) ? a : b;
+			const Ball& ball = isBox(a) ? b : a;
+			const Real hw = Real(box.width) * Real(0.5f), hd = Real(box.depth) * Real(0.5f);
+			return touchBox(Real(ball.x), Real(ball.z), Real(ball.radius), Real(box.x) - hw, Real(box.x) + hw,
+				Real(box.z) - hd, Real(box.z) + hd);
+		}
+		Real dx, dz;
+		return circlesOverlap(a, b, dx, dz);
+	}
+
+	// turn the velocity of a ball at (dx,dz) from the center of what it hit to point
+	// away from that center, keeping its speed
+	template<class T>
+	inline void deflect(T dx, T dz, T& vx, T& vz)
+	{
+		T size_D = norm(dx, dz);
+		if (size_D <= T(0.0f))
+			return;
+
+		T size_V = norm(vx, vz);
+		T k = size_V / size_D;
+		vx = k * dx;
+		vz = k * dz;
+	}
+
+	// the same in fixed point, with k = |v| / |d| rounded once as the root of the ratio
+	// of the squares rather than from two rounded roots and a 64 bit divide
+	inline void deflect(Fixed dx, Fixed dz, Fixed& vx, Fixed& vz)
+	{
+		const unsigned long long dd = normSquared(dx, dz);
+		if (dd == 0)
+			return;
+		const Fixed k = Fixed::fromRaw(rootOfRatio(normSquared(vx, vz), dd));
+		vx = k * dx;
+		vz = k * dz;
+	}
+
+	// a box target reflects the ball off the face (or corner) it hit; a round one turns
+	// it away from its center, keeping its speed
+	inline void hitBy(const Ball& target, Ball& ball)
+	{
+		Real dx, dz;
+		if (isBox(target))
+			pushOutOfBox(ball.x, ball.z, ball.vx, ball.vz, ball.radius, target.x - target.width / 2,
+				target.x + target.width / 2, target.z - target.depth / 2, target.z + target.depth / 2);
+		else if (circlesOverlap(target, ball, dx, dz)) {
+			Real vx(ball.vx), vz(ball.vz);
+			deflect(dx, dz, vx, vz);
+			ball.vx = toFloat(vx);
+			ball.vz = toFloat(vz);
+		}
+	}
+
+	inline void ballUpdate(Ball& b, float timeDiff)
+	{
+		if (std::fabs(b.vx) > 0.01f || std::fabs(b.vz) > 0.01f)
+		{
+			const Real k(TIME_SCALE * timeDiff);
+			b.x = toFloat(Real(b.x) + k * Real(b.vx));
+			b.z = toFloat(Real(b.z) + k * Real(b.vz));
+		}
+	}
+
+	//
+	// Wall / ball. a wall is the box of its own position and size (see legoWalls.h)
+	//
+
+	inline bool hasIntersected(const Wall& wall, const Ball& b)
+	{
+		const Real hw = Real(wall.width) * Real(0.5f), hd = Real(wall.depth) * Real(0.5f);
+		return touchBox(Real(b.x), Real(b.z), Real(b.radius), Real(wall.x) - hw, Real(wall.x) + hw,
+			Real(wall.z) - hd, Real(wall.z) + hd);
+	}
+
+	// move the ball out of the wall and reflect only the component heading into it, so
+	// hitting a corner of two walls in one step does not flip it back
+	inline void hitBy(const Wall& wall, Ball& b)
+	{
+		pushOutOfBox(b.x, b.z, b.vx, b.vz, b.radius, wall.x - wall.width / 2, wall.x + wall.width / 2,
+			wall.z - wall.depth / 2, wall.z + wall.depth / 2);
+	}
+
+	//
+	// Continuous collision
+	//
+
+	// fraction t in [0,1] of the move (dx,dz) at which a ball at (x,z) first touches a
+	// circle at (cx,cz), r being the sum of both radii. -1 if they do not meet or if the
+	// ball is moving away from the circle (see circleTime).
+	template<class T>
+	inline T sweepCircle(T x, T z, T dx, T dz, T cx, T cz, T r)
+	{
+		return circleTime(x - cx, z - cz, dx, dz, r);
+	}
+
+	struct Contact
+	{
+		enum Type { NONE, WALL, FLOOR, BRICK, BALL };
+
+		Real t;
+		int  type;
+		int  id;        // ball hit for BRICK and BALL, wall for WALL and FLOOR
+		Real nx, nz;    // normal out of the wall or brick for WALL and BRICK
+
+		Contact() : t(2.0f), type(NONE), id(-1), nx(0.0f), nz(0.0f) {}
+
+		// keep the earliest contact; on a tie the first one found wins
+		void offer(Real time, int what, int which = -1, Real normalX = Real(0.0f), Real normalZ = Real(0.0f))
+		{
+			if (time >= Real(0.0f) && time < t) {
+				t = time;
+				type = what;
+				id = which;
+				nx = normalX;
+				nz = normalZ;
+			}
+		}
+	};
+
+	// mirror the velocity in the normal of the wall or brick face of c
+	inline void reflect(Real& vx, Real& vz, const Contact& c)
+	{
+		const Real vn = vx * c.nx + vz * c.nz;
+		vx -= Real(2.0f) * vn * c.nx;
+		vz -= Real(2.0f) * vn * c.nz;
+	}
+
+	// a pointer that copies do not inherit (see World::setThreadPool)
+	struct PoolRef
+	{
+		ThreadPool* pool;
+
+		PoolRef() : pool(0) {}
+		PoolRef(const PoolRef&) : pool(0) {}
+		PoolRef& operator=(const PoolRef&) { return *this; }
+	};
+
+	//
+	// World. Balls are known by ids that stay valid until the ball is removed; the
+	// arrays hold only the live balls, packed, in an order that changes on removal.
+	// Any number of shot balls may be in play at once (multi-ball).
+	//
+
+	class World
+	{
+	public:
+		enum State { READY, PLAYING, CLEARED, FAILED };
+
+		World() : m_layout(0), m_interpolate(false) { clear(); }
+
+		void clear()
+		{
+			m_balls.clear();
+			m_handles.clear();
+			m_walls.clear();
+			m_wallBoxes.clear();
+			m_shots.clear();
+			m_paddle = m_marker = -1;
+			m_numBricks = 0;
+			m_cleared = 0;
+			m_state = READY;
+			layoutChanged();
+			m_prevX.clear();
+			m_prevZ.clear();
+			m_broken.clear();
+			m_owner.reset();
+		}
+
+		// take the ball arrays from 'arena' (0 for the heap). call it on an empty world and
+		// clear() the world before resetting the arena; copies of the world use the heap.
+		void setArena(Arena* arena)
+		{
+			m_balls.setArena(arena);
+			m_prevX.setArena(arena);
+			m_prevZ.setArena(arena);
+		}
+
+		// keep the positions of the previous step so ballAt() can blend between the
+		// last two steps. off by default; only a renderer needs it.
+		void setInterpolation(bool on)
+		{
+			m_interpolate = on;
+			savePrevious();
+		}
+
+		// sweep many shots on the workers of 'pool' (0: the calling thread only). the pool
+		// is not owned, and copies of the world do not inherit it. the results are the
+		// same either way.
+		void setThreadPool(ThreadPool* pool) { m_pool.pool = pool; }
+
+		// O(1); the id of a removed ball may be reused. a BRICK given this way is the
+		// square of side 2 * radius; addBrick() makes any other size.
+		int addBall(int kind, float x, float z, float radius = BALL_RADIUS)
+		{
+			if (kind == BRICK)
+				return addBrick(x, z, 2 * radius, 2 * radius);
+			return add(kind, x, radius, z, radius, 0.0f, 0.0f);
+		}
+
+		// a brick of width along x and depth along z, standing on the table
+		int addBrick(float x, float z, float width = BRICK_WIDTH, float depth = BRICK_DEPTH)
+		{
+			return add(BRICK, x, BRICK_HEIGHT / 2, z, brickRadius(width, depth), width, depth);
+		}
+
+		// take a ball out of play, e.g. a cleared brick. O(1) but for shots: the last ball
+		// moves into its place in the arrays. a paddle or marker removed this way is gone,
+		// paddle() and marker() return -1.
+		void removeBall(int id)
+		{
+			if (!m_handles.alive(id))
+				return;
+			const int kind = m_balls.kind[m_handles.slot(id)];
+			if (kind == BRICK)
+				layoutChanged();
+			if (kind == SHOT)
+				m_shots.erase(std::find(m_shots.begin(), m_shots.end(), id));
+			unlinkBall(id);
+		}
+
+		// use n balls given as arrays in place instead of copying them, e.g. from a
+		// mapped level file. owner keeps the memory alive as long as the world uses it.
+		// earlier balls are replaced; walls are kept.
+		void adoptBalls(int n, float* x, float* y, float* z, float* vx, float* vz,
+			float* radius, float* width, float* depth, int* kind, const std::shared_ptr<void>& owner)
+		{
+			m_balls.x.adopt(x, n);   m_balls.y.adopt(y, n); m_balls.z.adopt(z, n);
+			m_balls.vx.adopt(vx, n); m_balls.vz.adopt(vz, n);
+			m_balls.radius.adopt(radius, n);
+			m_balls.width.adopt(width, n); m_balls.depth.adopt(depth, n);
+			m_balls.kind.adopt(kind, n);
+#if defined(PHYS_FIXED)
+			float* arrays[8] = { x, y, z, vx, vz, radius, width, depth };
+			for (int a = 0; a < 8; a++)
+				for (int i = 0; i < n; i++)
+					arrays[a][i] = quantize(arrays[a][i]);
+#endif
+			m_handles.reset(n);
+			m_owner = owner;
+
+			m_shots.clear();
+			m_paddle = m_marker = -1;
+			m_numBricks = 0;
+			for (int i = 0; i < n; i++)
+				addRole(kind[i], i);
+			layoutChanged();
+		}
+
+		int addWall(float x, float z, float width, float depth, int kind = SOLID_WALL)
+		{
+			Wall w;
+			w.x = quantize(x); w.z = quantize(z);
+			w.width = quantize(width); w.depth = quantize(depth);
+			w.kind = kind;
+			m_walls.push_back(w);
+			m_wallBoxes.add(x, z, width, depth);
+			layoutChanged();
+			return (int)m_walls.size() - 1;
+		}
+
+		// gather / scatter one live ball. the simulation itself works on the arrays.
+		Ball ball(int id) const
+		{
+			const int i = m_handles.slot(id);
+			Ball b;
+			b.x  = m_balls.x[i];  b.y  = m_balls.y[i]; b.z = m_balls.z[i];
+			b.vx = m_balls.vx[i]; b.vz = m_balls.vz[i];
+			b.radius = m_balls.radius[i];
+			b.width  = m_balls.width[i]; b.depth = m_balls.depth[i];
+			b.kind   = m_balls.kind[i];
+			return b;
+		}
+
+		void setBall(int id, const Ball& b)
+		{
+			const int i = m_handles.slot(id);
+			m_balls.x[i]  = quantize(b.x);  m_balls.y[i]  = quantize(b.y); m_balls.z[i] = quantize(b.z);
+			m_balls.vx[i] = quantize(b.vx); m_balls.vz[i] = quantize(b.vz);
+			m_balls.radius[i] = quantize(b.radius);
+			m_balls.width[i] = quantize(b.width); m_balls.depth[i] = quantize(b.depth);
+			moved(i);
+		}
+
+		// a ball placed by hand jumps there; it is not blended from its old position
+		void setCenter(int id, float x, float y, float z)
+		{
+			const int i = m_handles.slot(id);
+			x = quantize(x); y = quantize(y); z = quantize(z);
+			m_balls.x[i] = x; m_balls.y[i] = y; m_balls.z[i] = z;
+			if (i < (int)m_prevX.size()) {
+				m_prevX[i] = x;
+				m_prevZ[i] = z;
+			}
+			moved(i);
+		}
+
+		// ball 'id' at alpha in [0,1] between the previous step and the current one
+		Ball ballAt(int id, float alpha) const
+		{
+			const int i = m_handles.slot(id);
+			Ball b = ball(id);
+			if (i >= (int)m_prevX.size())
+				return b;
+			b.x = m_prevX[i] + (b.x - m_prevX[i]) * alpha;
+			b.z = m_prevZ[i] + (b.z - m_prevZ[i]) * alpha;
+			return b;
+		}
+
+		// copy the state of play into s: the balls, their ids, the shots and the score.
+		// walls are part of the level and are not saved. tick is kept with the snapshot.
+		// a world of a few balls takes well under a microsecond.
+		void save(Snapshot& s, unsigned int tick = 0) const
+		{
+			ScopedTimer timer(PHASE_SNAPSHOT);
+			int header[6] = { m_paddle, m_marker, m_numBricks, m_cleared, (int)m_state, (int)m_walls.size() };
+			s.begin(tick);
+			s.put(header, sizeof(header));
+			m_balls.save(s);
+			m_handles.save(s);
+			s.putArray(m_shots);
+			s.putArray(m_prevX);
+			s.putArray(m_prevZ);
+		}
+
+		// go back to a snapshot of this world, or of one with the same walls (e.g. a
+		// copy). false if the walls differ or s holds no snapshot; the world is left
+		// as it was if the walls differ.
+		bool restore(const Snapshot& s)
+		{
+			ScopedTimer timer(PHASE_SNAPSHOT);
+			SnapshotReader r(s);
+			int header[6];
+			if (!r.get(header, sizeof(header)) || header[5] != (int)m_walls.size())
+				return false;
+			m_paddle = header[0]; m_marker = header[1];
+			m_numBricks = header[2]; m_cleared = header[3];
+			m_state = (State)header[4];
+			bool ok = m_balls.restore(r) && m_handles.restore(r)
+				&& r.getArray(m_shots) && r.getArray(m_prevX) && r.getArray(m_prevZ);
+			m_broken.clear();
+			layoutChanged();
+			return ok;
+		}
+
+		void setVelocity(int id, float vx, float vz)
+		{
+			const int i = m_handles.slot(id);
+			m_balls.vx[i] = quantize(vx); m_balls.vz[i] = quantize(vz);
+		}
+
+		// the live balls by slot; ballId() tells which ball is in a slot. writable access
+		// may move bricks, so the broad phase is rebuilt on the next step
+		BallStore&       balls(void)       { layoutChanged(); return m_balls; }
+		const BallStore& balls(void) const { return m_balls; }
+		const Wall& wall(int id) const { return m_walls[id]; }
+
+		// iterate the live balls with ballId(0 .. numBalls() - 1)
+		int numBalls(void)  const { return m_balls.size(); }
+		int ballId(int slot) const { return m_handles.id(slot); }
+		bool isAlive(int id) const { return m_handles.alive(id); }
+		int numBallIds(void) const { return m_handles.numIds(); }  // every ball id is below this
+
+		int numWalls(void)  const { return (int)m_walls.size(); }
+		int numBricks(void) const { return m_numBricks; }
+		int cleared(void)   const { return m_cleared; }
+		int shot(void)      const { return m_shots.empty() ? -1 : m_shots[0]; }  // the first shot
+		int numShots(void)  const { return (int)m_shots.size(); }
+		int shotId(int i)   const { return m_shots[i]; }
+		// the bricks the last step cleared, as they were, e.g. to show them break
+		int numBroken(void) const { return (int)m_broken.size(); }
+		const Ball& broken(int i) const { return m_broken[i]; }
+		int paddle(void)    const { return m_paddle; }
+		int marker(void)    const { return m_marker; }
+		State state(void)   const { return m_state; }
+		// changes whenever the bricks or walls may have, e.g. to know when something
+		// worked out from them is out of date
+		unsigned int layout(void) const { return m_layout; }
+
+		// fire every shot towards the marker from where it is. only the first call has an
+		// effect.
+		bool launch(void)
+		{
+			if (m_state != READY || m_shots.empty() || m_marker < 0)
+				return false;
+			Ball marker = ball(m_marker);
+			const Real scale(LAUNCH_SCALE);
+			for (size_t i = 0; i < m_shots.size(); i++) {
+				Ball shot = ball(m_shots[i]);
+				setVelocity(m_shots[i], toFloat(scale * (Real(marker.x) - Real(shot.x))),
+					toFloat(scale * (Real(marker.z) - Real(shot.z))));
+			}
+			return play();
+		}
+
+		// fire every shot with the given velocity
+		bool launch(float vx, float vz)
+		{
+			if (m_state != READY || m_shots.empty())
+				return false;
+			for (size_t i = 0; i < m_shots.size(); i++)
+				setVelocity(m_shots[i], vx, vz);
+			return play();
+		}
+
+		// multi-ball: every shot in play splits into 'ways' balls of the same speed,
+		// fanned out SPLIT_ANGLE apart around its direction. returns the balls added.
+		int splitShots(int ways)
+		{
+			if (m_state != PLAYING)
+				return 0;
+			int added = 0;
+			const size_t n = m_shots.size();
+			for (size_t i = 0; i < n; i++) {
+				Ball s = ball(m_shots[i]);
+				for (int w = 1; w < ways; w++) {
+					// alternately left and right of the original
+					Real a(SPLIT_ANGLE * ((w + 1) / 2) * (w % 2 ? 1.0f : -1.0f));
+					Real c = cosOf(a), sn = sinOf(a), vx(s.vx), vz(s.vz);
+					int id = addBall(SHOT, s.x, s.z, s.radius);
+					setVelocity(id, toFloat(c * vx - sn * vz), toFloat(sn * vx + c * vz));
+					added++;
+				}
+			}
+			return added;
+		}
+
+		// the first contact of a ball of radius r at (x,z) moving by (dx,dz), however far,
+		// found the way a step finds it: walls, the paddle, and the bricks but the numSkip
+		// ids in skip. for looking ahead, e.g. the aim preview; the bricks are searched a
+		// cell of the move at a time and only up to the first contact, so a long move
+		// across many bricks costs little more than a short one.
+		Contact cast(Real x, Real z, Real dx, Real dz, Real r, const int* skip = 0, int numSkip = 0)
+		{
+			if (m_gridDirty)
+				rebuildGrid();
+
+			Contact c;
+			Real t, nx, nz;
+			int wall = sweepWalls(m_wallBoxes, x, z, dx, dz, r, t, nx, nz);
+			if (wall >= 0)
+				c.offer(t, m_walls[wall].kind == FLOOR_WALL ? Contact::FLOOR : Contact::WALL, wall, nx, nz);
+			if (m_paddle >= 0) {
+				int j = m_handles.slot(m_paddle);
+				c.offer(sweepCircle(x, z, dx, dz, Real(m_balls.x[j]), Real(m_balls.z[j]),
+					r + Real(m_balls.radius[j])), Contact::BALL, m_paddle);
+			}
+
+			// a brick touched in piece p of the move is among the candidates of that piece,
+			// so once a contact comes before the next piece the rest can not beat it
+			const Real half(0.5f);
+			const int pieces = 1 + (int)(toFloat(norm(dx, dz)) / (2 * BALL_RADIUS));
+			for (int p = 0; p < pieces && Real((float)p / pieces) < c.t; p++) {
+				const Real t0((float)p / pieces), t1((float)(p + 1) / pieces);
+				m_castCandidates.clear();
+				m_brickGrid.queryPath(toFloat(x + t0 * dx), toFloat(z + t0 * dz),
+					toFloat((t1 - t0) * dx), toFloat((t1 - t0) * dz), toFloat(r),
+					[this, skip, numSkip](int slot) {
+						int id = m_handles.id(slot);
+						if (std::find(skip, skip + numSkip, id) == skip + numSkip)
+							m_castCandidates.push_back(id);
+					});
+				std::sort(m_castCandidates.begin(), m_castCandidates.end());
+				for (size_t i = 0; i < m_castCandidates.size(); i++) {
+					int id = m_castCandidates[i], j = m_handles.slot(id);
+					const Real bx(m_balls.x[j]), bz(m_balls.z[j]);
+					const Real hw = Real(m_balls.width[j]) * half, hd = Real(m_balls.depth[j]) * half;
+					t = sweepBox(x, z, dx, dz, r, bx - hw, bx + hw, bz - hd, bz + hd, nx, nz);
+					c.offer(t, Contact::BRICK, id, nx, nz);
+				}
+			}
+			return c;
+		}
+
+		void step(float timeDelta)
+		{
+			ScopedTimer timer(PHASE_STEP);
+			savePrevious();
+			m_broken.clear();
+			if (m_state == CLEARED || m_state == FAILED)
+				return;
+
+			const float k = TIME_SCALE * timeDelta;
+
+			// everything but the shots moves freely; the shots are swept below
+			m_sweeps.resize(m_shots.size());
+			for (size_t i = 0; i < m_shots.size(); i++)
+				m_sweeps[i].s = ball(m_shots[i]);
+			{
+				ScopedTimer integrate(PHASE_INTEGRATE);
+				integrateBalls(m_balls.x.data(), m_balls.z.data(),
+					m_balls.vx.data(), m_balls.vz.data(), m_balls.size(), k);
+				// free moving balls bounce off the walls too
+				collideWalls(m_wallBoxes, m_balls.x.data(), m_balls.z.data(),
+					m_balls.vx.data(), m_balls.vz.data(), m_balls.radius.data(), m_balls.size());
+			}
+
+			if (m_shots.empty())
+				return;
+			// wall and ball contacts are timed apart, one sample each per step of play
+			// with the time of all workers summed
+			Stopwatch walls, balls;
+			bool playing = m_state == PLAYING;
+			sweepShots(k, walls, balls);
+			if (playing) {
+				walls.record(PHASE_WALLS);
+				balls.record(PHASE_BALLS);
+			}
+			finishStep();
+		}
+
+	private:
+		// one shot in flight during step()
+		struct Sweep
+		{
+			Ball  s;
+			int   island;
+			int   hits;     // bricks it cleared
+			bool  done;     // it reached the floor or cleared the last brick
+		};
+
+		// what a worker thread needs for itself
+		struct Scratch
+		{
+			std::vector<int> candidates;
+			Stopwatch        walls, balls;
+		};
+
+		bool play(void)
+		{
+			if (m_marker >= 0)
+				removeBall(m_marker);
+			m_state = PLAYING;
+			return true;
+		}
+
+		int add(int kind, float x, float y, float z, float radius, float width, float depth)
+		{
+			x = quantize(x); y = quantize(y); z = quantize(z);
+			radius = quantize(radius); width = quantize(width); depth = quantize(depth);
+			m_balls.add(kind, x, y, z, radius, width, depth);
+			if (m_interpolate) {
+				m_prevX.push_back(x);
+				m_prevZ.push_back(z);
+			}
+			int id = m_handles.add();
+			addRole(kind, id);
+			layoutChanged();
+			return id;
+		}
+
+		// remove a ball that is off m_shots already
+		void unlinkBall(int id)
+		{
+			int slot = m_handles.remove(id);
+			m_balls.remove(slot);
+			if (slot < (int)m_prevX.size()) {
+				m_prevX.removeSwap(slot);
+				m_prevZ.removeSwap(slot);
+			}
+			if (id == m_paddle) m_paddle = -1;
+			if (id == m_marker) m_marker = -1;
+		}
+
+		bool parallel(size_t count) const
+		{
+			return m_pool.pool && m_pool.pool->size() > 1 && count >= (size_t)MIN_PARALLEL_SHOTS;
+		}
+
+		// sweep all shots against walls, bricks and the paddle. shots that can not reach
+		// the same brick fall into different islands, which run on different workers; the
+		// shots of an island are swept one after the other. bricks that are hit are only
+		// marked here, so the arrays do not change under the workers.
+		void sweepShots(float k, Stopwatch& walls, Stopwatch& balls)
+		{
+			balls.start();
+			if (m_gridDirty)
+				rebuildGrid();
+			m_hit.assign(m_handles.numIds(), 0);
+			const int numIslands = findIslands(k);
+			balls.stop();
+
+			const int remaining = m_numBricks - m_cleared;
+			const bool threads = parallel(m_sweeps.size()) && numIslands > 1;
+			m_scratch.resize(threads ? m_pool.pool->size() : 1);
+			for (size_t w = 0; w < m_scratch.size(); w++)
+				m_scratch[w].walls = m_scratch[w].balls = Stopwatch();
+
+			if (threads) {
+				m_pool.pool->run(numIslands, [this, k, remaining](int island, int worker) {
+					sweepIsland(island, k, remaining, m_scratch[worker]);
+				});
+			}
+			else {
+				for (int i = 0; i < numIslands; i++)
+					sweepIsland(i, k, remaining, m_scratch[0]);
+			}
+			for (size_t w = 0; w < m_scratch.size(); w++) {
+				walls.add(m_scratch[w].walls);
+				balls.add(m_scratch[w].balls);
+			}
+		}
+
+		// group the shots into islands: shots that may reach the same brick this step
+		// share an island. returns the number of islands, numbered in the order of their
+		// first shot; m_islandShots lists the shots of island i in order from
+		// m_islandStart[i].
+		int findIslands(float k)
+		{
+			// the shots are 0 .. n-1 in the union-find, the bricks n + their slot after them
+			const int n = (int)m_sweeps.size();
+			m_parent.resize(n + m_balls.size());
+			for (size_t i = 0; i < m_parent.size(); i++)
+				m_parent[i] = (int)i;
+			for (int i = 0; i < n; i++) {
+				const Ball& s = m_sweeps[i].s;
+				// bounces keep the speed, so the whole path stays within one step's length
+				float reach = k * std::sqrt(s.vx * s.vx + s.vz * s.vz) + s.radius;
+				m_brickGrid.query(s.x, s.z, reach, [this, i, n](int slot) { unite(i, n + slot); });
+			}
+
+			int numIslands = 0;
+			m_islandOf.assign(n, -1);
+			for (int i = 0; i < n; i++) {
+				int root = findRoot(i);
+				if (m_islandOf[root] < 0)
+					m_islandOf[root] = numIslands++;
+				m_sweeps[i].island = m_islandOf[root];
+			}
+			m_islandStart.assign(numIslands + 1, 0);
+			for (int i = 0; i < n; i++)
+				m_islandStart[m_sweeps[i].island + 1]++;
+			for (int i = 0; i < numIslands; i++)
+				m_islandStart[i + 1] += m_islandStart[i];
+			m_islandShots.resize(n);
+			m_fill.assign(m_islandStart.begin(), m_islandStart.end() - 1);
+			for (int i = 0; i < n; i++)
+				m_islandShots[m_fill[m_sweeps[i].island]++] = i;
+			return numIslands;
+		}
+
+		// call f(a, b) for every pair of shots closer than r[a] + r[b], through a grid
+		// over the shots with cells twice the largest r
+		template<class F>
+		void forEachShotPair(const float* r, F f)
+		{
+			const int n = (int)m_sweeps.size();
+			if (n < 2)
+				return;
+			m_shotX.resize(n);
+			m_shotZ.resize(n);
+			float minX = m_sweeps[0].s.x, maxX = minX, minZ = m_sweeps[0].s.z, maxZ = minZ, maxR = 0.0f;
+			for (int i = 0; i < n; i++) {
+				const Ball& b = m_sweeps[i].s;
+				m_shotX[i] = b.x;
+				m_shotZ[i] = b.z;
+				minX = b.x < minX ? b.x : minX; maxX = b.x > maxX ? b.x : maxX;
+				minZ = b.z < minZ ? b.z : minZ; maxZ = b.z > maxZ ? b.z : maxZ;
+				maxR = r[i] > maxR ? r[i] : maxR;
+			}
+			// no more cells than a few per shot, however far apart the shots are
+			float cell = 2 * maxR > 1e-3f ? 2 * maxR : 1e-3f;
+			float area = (maxX - minX) * (maxZ - minZ);
+			if (area > 4.0f * n * cell * cell)
+				cell = std::sqrt(area / (4.0f * n));
+			m_shotGrid.init(minX, minZ, maxX + cell, maxZ + cell, cell);
+			m_shotGrid.build(m_shotX.data(), m_shotZ.data(), r, n, [](int) { return true; });
+			m_shotGrid.forEachPair([&](int a, int b) {
+				float dx = m_shotX[a] - m_shotX[b], dz = m_shotZ[a] - m_shotZ[b], d = r[a] + r[b];
+				if (dx * dx + dz * dz < d * d)
+					f(a, b);
+			});
+		}
+
+		int findRoot(int i)
+		{
+			while (m_parent[i] != i)
+				i = m_parent[i] = m_parent[m_parent[i]];
+			return i;
+		}
+
+		void unite(int a, int b)
+		{
+			a = findRoot(a);
+			b = findRoot(b);
+			if (a != b)
+				m_parent[a > b ? a : b] = a < b ? a : b;
+		}
+
+		// remaining is the number of bricks left at the start of the step; whoever clears
+		// the last of them ends the level
+		void sweepIsland(int island, float k, int remaining, Scratch& scratch)
+		{
+			for (int i = m_islandStart[island]; i < m_islandStart[island + 1]; i++) {
+				Sweep& w = m_sweeps[m_islandShots[i]];
+				sweepShot(w, k, remaining, scratch);
+				remaining -= w.hits;
+			}
+		}
+
+		// move a shot by k * velocity. instead of testing for overlap at the end of the
+		// step, every wall, brick and paddle contact on the way is found by its time of
+		// impact and resolved in time order, so a long step can not tunnel through them.
+		// the shot moves in Real and goes back to s when done.
+		void sweepShot(Sweep& w, float k, int remaining, Scratch& scratch)
+		{
+			Ball& s = w.s;
+			w.hits = 0;
+			w.done = false;
+			if (std::fabs(s.vx) <= 0.01f && std::fabs(s.vz) <= 0.01f)
+				return;
+
+			std::vector<int>& candidates = scratch.candidates;
+
+			const Real zero(0.0f), one(1.0f), half(0.5f), rk(k), r(s.radius);
+			Real x(s.x), z(s.z), vx(s.vx), vz(s.vz);
+			Real left = one;    // part of the step still to move
+			for (int n = 0; n < MAX_CONTACTS && left > zero && !w.done; n++) {
+				const Real dx = left * rk * vx;
+				const Real dz = left * rk * vz;
+
+				Contact c;
+				// every wall at once. touching the floor ends the game for this shot
+				scratch.walls.start();
+				Real t, nx, nz;
+				int wall = sweepWalls(m_wallBoxes, x, z, dx, dz, r, t, nx, nz);
+				if (wall >= 0)
+					c.offer(t, m_walls[wall].kind == FLOOR_WALL ? Contact::FLOOR : Contact::WALL, wall, nx, nz);
+				scratch.walls.stop();
+
+				// broad phase over the cells along the move; bricks hit this step are out
+				// already. candidates are tested in id order so the result does not depend
+				// on the grid.
+				scratch.balls.start();
+				candidates.clear();
+				m_brickGrid.queryPath(toFloat(x), toFloat(z), toFloat(dx), toFloat(dz), s.radius,
+					[this, &candidates](int slot) {
+						int id = m_handles.id(slot);
+						if (!m_hit[id])
+							candidates.push_back(id);
+					});
+				std::sort(candidates.begin(), candidates.end());
+				for (size_t i = 0; i < candidates.size(); i++) {
+					int id = candidates[i], j = m_handles.slot(id);
+					const Real bx(m_balls.x[j]), bz(m_balls.z[j]);
+					const Real hw = Real(m_balls.width[j]) * half, hd = Real(m_balls.depth[j]) * half;
+					t = sweepBox(x, z, dx, dz, r, bx - hw, bx + hw, bz - hd, bz + hd, nx, nz);
+					c.offer(t, Contact::BRICK, id, nx, nz);
+				}
+				if (m_paddle >= 0) {
+					int j = m_handles.slot(m_paddle);
+					c.offer(sweepCircle(x, z, dx, dz, Real(m_balls.x[j]), Real(m_balls.z[j]),
+						r + Real(m_balls.radius[j])), Contact::BALL, m_paddle);
+				}
+				scratch.balls.stop();
+
+				if (c.type == Contact::NONE) {
+					x += dx;
+					z += dz;
+					break;
+				}
+
+				x += c.t * dx;
+				z += c.t * dz;
+				left *= one - c.t;
+
+				switch (c.type) {
+				case Contact::BRICK:
+					m_hit[c.id] = 1;
+					if (++w.hits == remaining)
+						w.done = true;
+					else
+						reflect(vx, vz, c);
+					break;
+				case Contact::WALL:
+					reflect(vx, vz, c);
+					break;
+				case Contact::FLOOR:
+					w.done = true;
+					break;
+				case Contact::BALL: {
+					// the round paddle turns the shot away from its center
+					const int j = m_handles.slot(c.id);
+					deflect(x - Real(m_balls.x[j]), z - Real(m_balls.z[j]), vx, vz);
+					break;
+				}
+				}
+			}
+			s.x = toFloat(x);
+			s.z = toFloat(z);
+			s.vx = toFloat(vx);
+			s.vz = toFloat(vz);
+		}
+
+		// shots that overlap after the sweeps and move towards each other trade the parts
+		// of their velocities along the line between them, as equal masses do. the pairs
+		// are colored so that no shot appears twice in a color; the pairs of one color run
+		// on all workers, the colors one after the other, and the result does not depend
+		// on the number of workers.
+		void collideShots(void)
+		{
+			const int n = (int)m_sweeps.size();
+			m_radius.resize(n);
+			for (int i = 0; i < n; i++)
+				m_radius[i] = m_sweeps[i].done ? 0.0f : m_sweeps[i].s.radius;
+			m_pairs.clear();
+			forEachShotPair(m_radius.data(), [this](int a, int b) {
+				if (!m_sweeps[a].done && !m_sweeps[b].done)
+					m_pairs.push_back(a < b ? std::make_pair(a, b) : std::make_pair(b, a));
+			});
+			if (m_pairs.empty())
+				return;
+			std::sort(m_pairs.begin(), m_pairs.end());
+
+			// a pair takes the first color after those of both its shots
+			int numColors = 0;
+			m_nextColor.assign(n, 0);
+			m_colorOf.resize(m_pairs.size());
+			for (size_t i = 0; i < m_pairs.size(); i++) {
+				int a = m_pairs[i].first, b = m_pairs[i].second;
+				int c = m_nextColor[a] > m_nextColor[b] ? m_nextColor[a] : m_nextColor[b];
+				m_colorOf[i] = c;
+				m_nextColor[a] = m_nextColor[b] = c + 1;
+				if (c + 1 > numColors)
+					numColors = c + 1;
+			}
+			m_colorStart.assign(numColors + 1, 0);
+			for (size_t i = 0; i < m_pairs.size(); i++)
+				m_colorStart[m_colorOf[i] + 1]++;
+			for (int c = 0; c < numColors; c++)
+				m_colorStart[c + 1] += m_colorStart[c];
+			m_byColor.resize(m_pairs.size());
+			m_fill.assign(m_colorStart.begin(), m_colorStart.end() - 1);
+			for (size_t i = 0; i < m_pairs.size(); i++)
+				m_byColor[m_fill[m_colorOf[i]]++] = m_pairs[i];
+
+			for (int c = 0; c < numColors; c++) {
+				const int begin = m_colorStart[c], count = m_colorStart[c + 1] - begin;
+				if (parallel(count)) {
+					m_pool.pool->run(count, [this, begin](int i, int) {
+						bounce(m_sweeps[m_byColor[begin + i].first].s, m_sweeps[m_byColor[begin + i].second].s);
+					});
+				}
+				else {
+					for (int i = begin; i < begin + count; i++)
+						bounce(m_sweeps[m_byColor[i].first].s, m_sweeps[m_byColor[i].second].s);
+				}
+			}
+		}
+
+		static void bounce(Ball& a, Ball& b)
+		{
+			Real nx = Real(a.x) - Real(b.x), nz = Real(a.z) - Real(b.z);
+			Real d = norm(nx, nz);
+			if (d <= Real(0.0f))
+				return;
+			nx /= d;
+			nz /= d;
+			Real v = (Real(a.vx) - Real(b.vx)) * nx + (Real(a.vz) - Real(b.vz)) * nz;
+			if (v >= Real(0.0f))
+				return;
+			a.vx = toFloat(Real(a.vx) - v * nx); a.vz = toFloat(Real(a.vz) - v * nz);
+			b.vx = toFloat(Real(b.vx) + v * nx); b.vz = toFloat(Real(b.vz) + v * nz);
+		}
+
+		// apply the outcome of the sweeps: shots move on, bricks that were hit leave the
+		// world, and so do shots that were lost. the level is cleared when the last brick
+		// goes and failed when the last shot does.
+		void finishStep(void)
+		{
+			collideShots();
+
+			int hits = 0;
+			m_lost.clear();
+			size_t kept = 0;
+			for (size_t i = 0; i < m_sweeps.size(); i++) {
+				const Sweep& w = m_sweeps[i];
+				hits += w.hits;
+				if (w.done)
+					m_lost.push_back(m_shots[i]);
+				else {
+					setBall(m_shots[i], w.s);
+					m_shots[kept++] = m_shots[i];
+				}
+			}
+			m_shots.resize(kept);
+
+			// in id order, so the arrays end up the same however the islands were run
+			if (hits) {
+				for (int id = 0; id < (int)m_hit.size(); id++) {
+					if (m_hit[id]) {
+						m_broken.push_back(ball(id));
+						removeBall(id);
+					}
+				}
+				m_cleared += hits;
+				if (m_cleared == m_numBricks) {
+					m_lost.insert(m_lost.end(), m_shots.begin(), m_shots.end());
+					m_shots.clear();
+					m_state = CLEARED;
+				}
+			}
+			for (size_t i = 0; i < m_lost.size(); i++)
+				unlinkBall(m_lost[i]);
+			if (m_state == CLEARED)
+				return;
+			if (m_shots.empty())
+				m_state = FAILED;
+		}
+
+		void addRole(int kind, int id)
+		{
+			switch (kind) {
+			case BRICK:  m_numBricks++; break;
+			case PADDLE: m_paddle = id; break;
+			case SHOT:   m_shots.push_back(id); break;
+			case MARKER: m_marker = id; break;
+			}
+		}
+
+		void savePrevious(void)
+		{
+			if (!m_interpolate)
+				return;
+			m_prevX = m_balls.x;
+			m_prevZ = m_balls.z;
+		}
+
+		void moved(int slot)
+		{
+			if (m_balls.kind[slot] == BRICK)
+				layoutChanged();
+		}
+
+		// bricks or walls may have changed: the grid is rebuilt before it is used next
+		void layoutChanged(void)
+		{
+			m_gridDirty = true;
+			m_layout++;
+		}
+
+		// bricks never move on their own, so the grid only changes when a ball is edited
+		void rebuildGrid(void)
+		{
+			float minX = -TABLE_HALF_X, maxX = TABLE_HALF_X;
+			float minZ = -TABLE_HALF_Z, maxZ = TABLE_HALF_Z;
+			for (size_t i = 0; i < m_walls.size(); i++) {
+				const Wall& w = m_walls[i];
+				if (i == 0 || w.x - w.width / 2 < minX) minX = w.x - w.width / 2;
+				if (i == 0 || w.x + w.width / 2 > maxX) maxX = w.x + w.width / 2;
+				if (i == 0 || w.z - w.depth / 2 < minZ) minZ = w.z - w.depth / 2;
+				if (i == 0 || w.z + w.depth / 2 > maxZ) maxZ = w.z + w.depth / 2;
+			}
+			m_brickGrid.init(minX, minZ, maxX, maxZ, 2 * BALL_RADIUS);
+
+			const int* kind = m_balls.kind.data();
+			m_brickGrid.build(m_balls.x.data(), m_balls.z.data(), m_balls.radius.data(), m_balls.size(),
+				[kind](int i) { return kind[i] == BRICK; });
+			m_gridDirty = false;
+		}
+
+		BallStore         m_balls;      // live balls by slot
+		HandleTable       m_handles;    // ball id <-> slot
+		std::vector<Wall> m_walls;
+		WallStore         m_wallBoxes;  // the same walls as boxes, for the kernels
+		std::vector<int> m_shots;   // ids of the shots in play, oldest first
+		int   m_paddle, m_marker;
+		int   m_numBricks;
+		int   m_cleared;
+		State m_state;
+
+		SpatialGrid       m_brickGrid;
+		bool              m_gridDirty;
+		unsigned int      m_layout;     // see layout()
+
+		// scratch of step()
+		PoolRef                 m_pool;
+		std::vector<Sweep>      m_sweeps;       // by index into m_shots
+		std::vector<Scratch>    m_scratch;      // by worker
+		std::vector<char>       m_hit;          // by ball id: bricks hit this step
+		SpatialGrid             m_shotGrid;
+		std::vector<float>      m_shotX, m_shotZ, m_radius;
+		std::vector<int>        m_parent, m_islandOf, m_islandStart, m_islandShots, m_fill;
+		std::vector<std::pair<int, int> > m_pairs, m_byColor;
+		std::vector<int>        m_nextColor, m_colorOf, m_colorStart, m_lost;
+		std::vector<Ball>       m_broken;       // bricks cleared by the last step
+		std::vector<int>        m_castCandidates;   // scratch of cast()
+
+		bool                m_interpolate;
+		AlignedArray<float> m_prevX, m_prevZ;
+
+		std::shared_ptr<void> m_owner;    // memory the ball arrays borrow, if any
+	};
+
+	//
+	// Levels
+	//
+
+	// the original table: four yellow bricks, the blue paddle, the magenta shot and the
+	// white aiming marker
+	inline void setupDefaultLevel(World& world)
+	{
+		const float brickPos[4][2] = { {-2.0f,3.0f} , {-0.7f,2.5f} , {2.0f,2.5f} , {0.7f,3.0f} };
+
+		world.clear();
+		for (int i = 0; i < 4; i++)
+			world.addBrick(brickPos[i][0], brickPos[i][1]);
+		world.addBall(PADDLE, 0.0f, -TABLE_HALF_Z + 0.1f + BALL_RADIUS);
+		world.addBall(SHOT,   0.0f, -TABLE_HALF_Z + 0.11f + 3 * BALL_RADIUS);
+		world.addBall(MARKER, 0.0f, 5.2f);
+
+		world.addWall( 0.0f,  TABLE_HALF_Z, 2 * TABLE_HALF_X, 0.12f);
+		world.addWall(-TABLE_HALF_X, 0.0f,  0.12f, 2 * TABLE_HALF_Z);
+		world.addWall( TABLE_HALF_X, 0.0f,  0.12f, 2 * TABLE_HALF_Z);
+		world.addWall( 0.0f, -TABLE_HALF_Z, 2 * TABLE_HALF_X, 0.12f, FLOOR_WALL);
+	}
+}
+
+#endif // __legoPhysicsH__
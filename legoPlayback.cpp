@@ -0,0 +1,63 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoPlayback.cpp
+//
+// Desc: Plays recorded games (see legoReplay.h) headless at full speed and
+//       checks every stored state hash, to catch physics changes that alter
+//       the outcome of existing recordings.
+//
+//       usage: legoPlayback replay.rpl [replay.rpl ...]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoLevel.h"
+#include "legoReplay.h"
+#include <chrono>
+#include <cstdio>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s replay.rpl [replay.rpl ...]\n", argv[0]);
+		return 1;
+	}
+
+	int failed = 0;
+	long long totalTicks = 0;
+	phys::Replay replay;
+	phys::World world;
+	std::string error;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 1; i < argc; i++) {
+		if (!replay.load(argv[i])) {
+			printf("%s: can not read\n", argv[i]);
+			failed++;
+			continue;
+		}
+		if (replay.level().empty()) {
+			phys::setupDefaultLevel(world);
+		}
+		else if (!phys::loadLevel(world, replay.level().c_str(), error)) {
+			printf("%s: %s\n", argv[i], error.c_str());
+			failed++;
+			continue;
+		}
+
+		unsigned int mismatch = replay.play(world);
+		totalTicks += replay.numTicks();
+		if (mismatch) {
+			printf("%s: MISMATCH at tick %u\n", argv[i], mismatch);
+			failed++;
+		}
+		else {
+			printf("%s: ok, %u ticks, %d/%d bricks\n", argv[i], replay.numTicks(),
+				world.cleared(), world.numBricks());
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	printf("%d of %d replays failed, %lld ticks in %.3f s\n",
+		failed, argc - 1, totalTicks, elapsed.count());
+	return failed ? 1 : 0;
+}
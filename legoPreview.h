@@ -0,0 +1,202 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoPreview.h
+//
+// Desc: Where the shot would go if it were launched now. The ray from the shot towards
+//       the marker is cast through the walls, the bricks and the paddle with
+//       World::cast(), which walks the brick grid along it, and followed for a few
+//       bounces. The path is kept and only worked out again when the aim, the paddle,
+//       the bricks or the walls change; when only the paddle moved, only from the
+//       first leg the paddle can change.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoPreviewH__
+#define __legoPreviewH__
+
+#include "legoPhysics.h"
+#include <vector>
+
+namespace phys
+{
+	const int   PREVIEW_BOUNCES = 3;       // contacts the path turns at
+	const float PREVIEW_LENGTH  = 12.0f;   // longest path, along the table
+
+	class AimPreview
+	{
+	public:
+		// a straight part of the path
+		struct Leg
+		{
+			float x, z;         // start
+			float dirX, dirZ;   // unit direction
+			float along;        // length of the path before it
+			float length;
+			int   type, id;     // the Contact that ends it; NONE where the path runs out
+		};
+
+		explicit AimPreview(int bounces = PREVIEW_BOUNCES, float length = PREVIEW_LENGTH)
+			: m_bounces(bounces), m_length(length), m_x(0.0f), m_z(0.0f), m_dirX(0.0f), m_dirZ(0.0f),
+			  m_r(0.0f), m_layout(0), m_paddle(-1), m_paddleX(0.0f), m_paddleZ(0.0f), m_paddleR(0.0f) {}
+
+		// the path of the first shot towards the marker while aiming; none at other
+		// times. returns whether the path changed.
+		bool update(World& world)
+		{
+			if (world.state() != World::READY || world.shot() < 0 || world.marker() < 0)
+				return clear();
+			const Ball s = world.ball(world.shot()), m = world.ball(world.marker());
+			return update(world, s.x, s.z, m.x - s.x, m.z - s.z, s.radius);
+		}
+
+		// the path of a ball of radius r leaving (x,z) in the direction (dirX,dirZ).
+		// returns whether it changed.
+		bool update(World& world, float x, float z, float dirX, float dirZ, float r)
+		{
+			float px = 0.0f, pz = 0.0f, pr = 0.0f;
+			if (world.paddle() >= 0) {
+				const Ball p = world.ball(world.paddle());
+				px = p.x; pz = p.z; pr = p.radius;
+			}
+			const bool aimed = !m_legs.empty() && x == m_x && z == m_z && dirX == m_dirX
+				&& dirZ == m_dirZ && r == m_r && world.layout() == m_layout && world.paddle() == m_paddle;
+			if (aimed && px == m_paddleX && pz == m_paddleZ && pr == m_paddleR)
+				return false;
+
+			m_x = x; m_z = z; m_dirX = dirX; m_dirZ = dirZ; m_r = r;
+			m_layout = world.layout();
+			m_paddle = world.paddle();
+			m_paddleX = px; m_paddleZ = pz; m_paddleR = pr;
+
+			if (aimed) {
+				// only the paddle moved: the legs before the first it is in the way of, or
+				// was the end of, stay as they are
+				int from = 0;
+				const Real reach = Real(r) + Real(pr);
+				for (; from < (int)m_legs.size(); from++) {
+					const Leg& l = m_legs[from];
+					const Real length(l.length);
+					if (l.type == Contact::BALL || sweepCircle(Real(l.x), Real(l.z), length * Real(l.dirX),
+						length * Real(l.dirZ), Real(px), Real(pz), reach) >= Real(0.0f))
+						break;
+				}
+				if (from == (int)m_legs.size())
+					return false;
+				trace(world, from);
+				return true;
+			}
+
+			const Real dx(dirX), dz(dirZ), d = norm(dx, dz);
+			if (d <= Real(0.0f))
+				return clear();
+			m_legs.resize(1);
+			Leg& l = m_legs[0];
+			l.x = quantize(x);
+			l.z = quantize(z);
+			l.dirX = toFloat(dx / d);
+			l.dirZ = toFloat(dz / d);
+			l.along = 0.0f;
+			trace(world, 0);
+			return true;
+		}
+
+		// forget the path; returns whether there was one
+		bool clear(void)
+		{
+			const bool had = !m_legs.empty();
+			m_legs.clear();
+			return had;
+		}
+
+		int numLegs(void) const { return (int)m_legs.size(); }
+		const Leg& leg(int i) const { return m_legs[i]; }
+
+		// call f(x, z) for points every 'spacing' along the path, from its start, e.g. to
+		// draw it dotted
+		template<class F>
+		void sample(float spacing, F f) const
+		{
+			float next = 0.0f;
+			for (size_t i = 0; i < m_legs.size(); i++) {
+				const Leg& l = m_legs[i];
+				for (; next <= l.along + l.length; next += spacing) {
+					const float s = next - l.along;
+					f(l.x + s * l.dirX, l.z + s * l.dirZ);
+				}
+			}
+		}
+
+	private:
+
+		// follow the path from the start of leg 'from' on, resolving each contact the
+		// way World::step does; the legs after it are worked out again
+		void trace(World& world, int from)
+		{
+			m_legs.resize(from + 1);
+			m_skip.clear();
+			for (int i = 0; i < from; i++)
+				if (m_legs[i].type == Contact::BRICK)
+					m_skip.push_back(m_legs[i].id);
+			const int remaining = world.numBricks() - world.cleared();
+
+			const Real two(2.0f), r(m_r), total(m_length);
+			for (int i = from; ; i++) {
+				const Leg start = m_legs[i];
+				Real x(start.x), z(start.z), vx(start.dirX), vz(start.dirZ);
+				const Real along(start.along), left = total - along;
+				const Real dx = left * vx, dz = left * vz;
+
+				Contact c = world.cast(x, z, dx, dz, r, m_skip.data(), (int)m_skip.size());
+				const Real length = c.type == Contact::NONE ? left : c.t * left;
+				m_legs[i].length = toFloat(length);
+				m_legs[i].type = c.type;
+				m_legs[i].id = c.id;
+				if (c.type == Contact::NONE || c.type == Contact::FLOOR || i == m_bounces || !(length < left))
+					return;
+				if (c.type == Contact::BRICK) {
+					m_skip.push_back(c.id);
+					// the level would be cleared
+					if ((int)m_skip.size() == remaining)
+						return;
+				}
+
+				x += c.t * dx;
+				z += c.t * dz;
+				if (c.type == Contact::BALL) {
+					const Ball p = world.ball(c.id);
+					deflect(x - Real(p.x), z - Real(p.z), vx, vz);
+				}
+				else {
+					Real vn = vx * c.nx + vz * c.nz;
+					vx -= two * vn * c.nx;
+					vz -= two * vn * c.nz;
+				}
+
+				Leg next;
+				next.x = toFloat(x);
+				next.z = toFloat(z);
+				next.dirX = toFloat(vx);
+				next.dirZ = toFloat(vz);
+				next.along = toFloat(along + length);
+				next.length = 0.0f;
+				next.type = Contact::NONE;
+				next.id = -1;
+				m_legs.push_back(next);
+			}
+		}
+
+		int   m_bounces;
+		float m_length;
+
+		// what the path was worked out for
+		float        m_x, m_z, m_dirX, m_dirZ, m_r;
+		unsigned int m_layout;
+		int          m_paddle;
+		float        m_paddleX, m_paddleZ, m_paddleR;
+
+		std::vector<Leg> m_legs;
+		std::vector<int> m_skip;    // bricks the path went through already
+	};
+}
+
+#endif // __legoPreviewH__
@@ -0,0 +1,267 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoProfile.h
+//
+// Desc: Per-phase frame timing. Scoped timers around the phases of a frame (integrate,
+//       wall and ball collisions, draw submission, Present) feed one histogram per phase.
+//       Recording is lock-free, so worker threads and the game loop can record while the
+//       overlay or a dump reads p50/p99/max.
+//
+//       Timing is compiled in with PHYS_PROFILE only; otherwise the timers are empty and
+//       cost nothing.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoProfileH__
+#define __legoProfileH__
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace phys
+{
+	enum Phase
+	{
+		PHASE_STEP,         // one World::step, all of the below
+		PHASE_INTEGRATE,    // moving the free balls
+		PHASE_WALLS,        // wall contacts of the shot
+		PHASE_BALLS,        // brick and paddle contacts of the shot, broad phase included
+		PHASE_PARTICLES,    // moving the debris of broken bricks
+		PHASE_SNAPSHOT,     // World::save and World::restore
+		PHASE_DRAW,         // draw submission, Clear to EndScene
+		PHASE_PRESENT,
+		PHASE_FRAME,        // from one frame to the next
+		NUM_PHASES
+	};
+
+	//
+	// Histogram of durations in nanoseconds. Buckets are log-linear: 8 per power of two,
+	// so a percentile is within 12.5% of the true value.
+	//
+
+	class Histogram
+	{
+	public:
+		enum { SUB_BITS = 3, SUB = 1 << SUB_BITS, NUM_BUCKETS = SUB + (64 - SUB_BITS) * SUB };
+
+		Histogram() { reset(); }
+
+		void record(unsigned long long ns)
+		{
+			m_counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+			m_total.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(ns, std::memory_order_relaxed);
+			unsigned long long top = m_max.load(std::memory_order_relaxed);
+			while (ns > top && !m_max.compare_exchange_weak(top, ns, std::memory_order_relaxed))
+				;
+		}
+
+		// not atomic as a whole; counts recorded meanwhile may or may not be cleared
+		void reset(void)
+		{
+			for (int i = 0; i < NUM_BUCKETS; i++)
+				m_counts[i].store(0, std::memory_order_relaxed);
+			m_total.store(0, std::memory_order_relaxed);
+			m_sum.store(0, std::memory_order_relaxed);
+			m_max.store(0, std::memory_order_relaxed);
+		}
+
+		unsigned long long count(void)   const { return m_total.load(std::memory_order_relaxed); }
+		unsigned long long maximum(void) const { return m_max.load(std::memory_order_relaxed); }
+
+		double mean(void) const
+		{
+			unsigned long long n = count();
+			return n ? (double)m_sum.load(std::memory_order_relaxed) / n : 0.0;
+		}
+
+		// upper bound of the bucket holding the p-th fraction (0..1) of the samples
+		unsigned long long percentile(double p) const
+		{
+			unsigned long long counts[NUM_BUCKETS];
+			unsigned long long n = 0;
+			for (int i = 0; i < NUM_BUCKETS; i++)
+				n += counts[i] = m_counts[i].load(std::memory_order_relaxed);
+			if (n == 0)
+				return 0;
+
+			unsigned long long rank = (unsigned long long)(p * n + 0.5);
+			if (rank < 1) rank = 1;
+			if (rank > n) rank = n;
+			unsigned long long seen = 0;
+			for (int i = 0; i < NUM_BUCKETS; i++) {
+				seen += counts[i];
+				if (seen >= rank) {
+					unsigned long long upper = i + 1 < NUM_BUCKETS ? lowerBound(i + 1) - 1 : ~0ULL;
+					return upper < maximum() ? upper : maximum();
+				}
+			}
+			return maximum();
+		}
+
+	private:
+		static int highestBit(unsigned long long v)
+		{
+			int b = 0;
+			if (v >> 32) { v >>= 32; b += 32; }
+			if (v >> 16) { v >>= 16; b += 16; }
+			if (v >> 8)  { v >>= 8;  b += 8; }
+			if (v >> 4)  { v >>= 4;  b += 4; }
+			if (v >> 2)  { v >>= 2;  b += 2; }
+			if (v >> 1)  { b += 1; }
+			return b;
+		}
+
+		static int bucket(unsigned long long v)
+		{
+			if (v < SUB)
+				return (int)v;
+			int e = highestBit(v);
+			return SUB + (e - SUB_BITS) * SUB + (int)((v >> (e - SUB_BITS)) & (SUB - 1));
+		}
+
+		static unsigned long long lowerBound(int i)
+		{
+			if (i < SUB)
+				return (unsigned long long)i;
+			int e = (i - SUB) / SUB + SUB_BITS;
+			return (unsigned long long)(SUB + (i - SUB) % SUB) << (e - SUB_BITS);
+		}
+
+		std::atomic<unsigned long long> m_counts[NUM_BUCKETS];
+		std::atomic<unsigned long long> m_total;
+		std::atomic<unsigned long long> m_sum;
+		std::atomic<unsigned long long> m_max;
+	};
+
+	//
+	// Profiler: one histogram per phase
+	//
+
+	class Profiler
+	{
+	public:
+		Profiler() : m_lastFrame(0) {}
+
+		Histogram&       phase(int p)       { return m_phases[p]; }
+		const Histogram& phase(int p) const { return m_phases[p]; }
+
+		static const char* name(int p)
+		{
+			static const char* names[NUM_PHASES] = {
+				"step", "integrate", "walls", "balls", "particles", "snapshot", "draw", "present", "frame" };
+			return p >= 0 && p < NUM_PHASES ? names[p] : "?";
+		}
+
+		static unsigned long long now(void)
+		{
+			return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// record the time since the previous call as PHASE_FRAME
+		void frame(void)
+		{
+			unsigned long long t = now();
+			unsigned long long last = m_lastFrame.exchange(t, std::memory_order_relaxed);
+			if (last)
+				m_phases[PHASE_FRAME].record(t - last);
+		}
+
+		void reset(void)
+		{
+			for (int p = 0; p < NUM_PHASES; p++)
+				m_phases[p].reset();
+			m_lastFrame.store(0, std::memory_order_relaxed);
+		}
+
+		// a table of every phase that has samples, times in microseconds
+		std::string report(void) const
+		{
+			std::string text;
+			char line[128];
+			sprintf(line, "%-10s %9s %9s %9s %9s %9s\n", "phase", "count", "p50 us", "p99 us", "max us", "mean us");
+			text += line;
+			for (int p = 0; p < NUM_PHASES; p++) {
+				const Histogram& h = m_phases[p];
+				if (!h.count())
+					continue;
+				sprintf(line, "%-10s %9llu %9.1f %9.1f %9.1f %9.1f\n", name(p), h.count(),
+					h.percentile(0.5) / 1000.0, h.percentile(0.99) / 1000.0, h.maximum() / 1000.0, h.mean() / 1000.0);
+				text += line;
+			}
+			return text;
+		}
+
+		bool dump(const char* path) const
+		{
+			FILE* fp = fopen(path, "w");
+			if (!fp)
+				return false;
+			fputs(report().c_str(), fp);
+			return fclose(fp) == 0;
+		}
+
+	private:
+		Profiler(const Profiler&);
+		Profiler& operator=(const Profiler&);
+
+		Histogram                        m_phases[NUM_PHASES];
+		std::atomic<unsigned long long>  m_lastFrame;
+	};
+
+	// the profiler every timer records to
+	inline Profiler& profiler(void)
+	{
+		static Profiler p;
+		return p;
+	}
+
+	//
+	// Timers. Stopwatch sums several start/stop intervals, e.g. of a loop, into one
+	// sample; ScopedTimer records its own lifetime.
+	//
+
+#if defined(PHYS_PROFILE)
+	class Stopwatch
+	{
+	public:
+		Stopwatch() : m_ns(0), m_start(0) {}
+		void start(void) { m_start = Profiler::now(); }
+		void stop(void)  { m_ns += Profiler::now() - m_start; }
+		void add(const Stopwatch& w) { m_ns += w.m_ns; }
+		void record(int phase) { profiler().phase(phase).record(m_ns); }
+
+	private:
+		unsigned long long m_ns;
+		unsigned long long m_start;
+	};
+#else
+	class Stopwatch
+	{
+	public:
+		void start(void) {}
+		void stop(void) {}
+		void add(const Stopwatch&) {}
+		void record(int) {}
+	};
+#endif
+
+	class ScopedTimer
+	{
+	public:
+		explicit ScopedTimer(int phase) : m_phase(phase) { m_watch.start(); }
+		~ScopedTimer() { m_watch.stop(); m_watch.record(m_phase); }
+
+	private:
+		ScopedTimer(const ScopedTimer&);
+		ScopedTimer& operator=(const ScopedTimer&);
+
+		Stopwatch m_watch;
+		int       m_phase;
+	};
+}
+
+#endif // __legoProfileH__
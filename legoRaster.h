@@ -0,0 +1,454 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoRaster.h
+//
+// Desc: Software backend of render::Renderer for machines without a GPU. Draw calls are
+//       recorded during the frame; endFrame() transforms and lights their vertices (one
+//       task per draw), bins the triangles into screen tiles and rasterizes the tiles on
+//       all cores. Gouraud shading with the fixed-function lighting of legoRender.h, a
+//       depth buffer and back-face culling, like the Direct3D game. Particles are flat
+//       squares, binned and drawn after the triangles of each tile. Frames are saved as
+//       binary PPM.
+//
+//       The image does not depend on the number of threads: triangles reach every tile
+//       in draw order.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoRasterH__
+#define __legoRasterH__
+
+#include "legoRender.h"
+#include "legoThreads.h"
+#include <cfloat>
+#include <cstdio>
+#include <vector>
+
+namespace render
+{
+	class SoftwareRenderer : public Renderer
+	{
+	public:
+		enum { TILE_SIZE = 64 };
+
+		SoftwareRenderer(int width, int height, int numThreads = 0)
+			: m_width(width), m_height(height), m_clear(0), m_light(), m_numParticles(0), m_pool(numThreads)
+		{
+			m_color.resize(width * height);
+			m_depth.resize(width * height);
+			m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+			m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+			m_bins.resize(m_tilesX * m_tilesY);
+			m_splatBins.resize(m_tilesX * m_tilesY);
+			m_view = m_proj = identity();
+			for (int l = 0; l < NUM_SPHERE_LODS; l++)
+				m_spheres[l] = makeSphere(1.0f, SPHERE_LOD_SLICES[l], SPHERE_LOD_SLICES[l]);
+		}
+
+		int width(void)  const { return m_width; }
+		int height(void) const { return m_height; }
+		int numThreads(void) const { return m_pool.size(); }
+
+		// 0x00RRGGBB per pixel, top row first
+		const std::vector<unsigned int>& pixels(void) const { return m_color; }
+
+		//
+		// Renderer
+		//
+
+		int createBox(float width, float height, float depth)
+		{
+			m_boxes.push_back(makeBox(width, height, depth));
+			return (int)m_boxes.size() - 1;
+		}
+
+		void destroyMeshes(void) { m_boxes.clear(); }
+
+		void setCamera(const Matrix& view, const Matrix& proj)
+		{
+			m_view = view;
+			m_proj = proj;
+		}
+
+		void setLight(const Light& light) { m_light = light; }
+
+		void beginFrame(unsigned int clearRGB)
+		{
+			m_clear = clearRGB;
+			m_draws.clear();
+			m_numParticles = 0;
+		}
+
+		void drawBox(int box, const Matrix& world, const Material& mtrl)
+		{
+			Draw d;
+			d.mesh = &m_boxes[box];
+			d.world = world;
+			d.mtrl = mtrl;
+			m_draws.push_back(d);
+		}
+
+		void drawSphere(const Vec3& center, float radius, const Material& mtrl)
+		{
+			// the unit sphere scaled to radius, at the detail its size on screen needs
+			float z = center.x * m_view.m[0][2] + center.y * m_view.m[1][2] + center.z * m_view.m[2][2] + m_view.m[3][2];
+			float pixels = z > 0.0f ? radius * m_proj.m[1][1] * m_height / 2 / z : FLT_MAX;
+
+			Draw d;
+			d.mesh = &m_spheres[sphereLod(pixels)];
+			d.world = identity();
+			d.world.m[0][0] = d.world.m[1][1] = d.world.m[2][2] = radius;
+			d.world.m[3][0] = center.x; d.world.m[3][1] = center.y; d.world.m[3][2] = center.z;
+			d.mtrl = mtrl;
+			m_draws.push_back(d);
+		}
+
+		void drawParticles(const float* x, const float* y, const float* z, const unsigned int* rgb, int n, float size)
+		{
+			m_px = x; m_py = y; m_pz = z;
+			m_prgb = rgb;
+			m_numParticles = n;
+			m_particleSize = size;
+		}
+
+		void endFrame(void)
+		{
+			const Matrix viewProj = m_view * m_proj;
+			const Vec3 eye = eyePosition(m_view);
+
+			// vertices and triangles of every draw, each draw on its own
+			m_triangles.resize(m_draws.size());
+			m_pool.run((int)m_draws.size(), [&](int d, int) {
+				setupDraw(m_draws[d], viewProj, eye, m_triangles[d]);
+			});
+
+			// bin in draw order, so every tile sees its triangles in the same order
+			for (size_t t = 0; t < m_bins.size(); t++)
+				m_bins[t].clear();
+			for (size_t d = 0; d < m_triangles.size(); d++) {
+				const std::vector<Triangle>& tris = m_triangles[d];
+				for (size_t i = 0; i < tris.size(); i++) {
+					const Triangle& tri = tris[i];
+					int tx0 = tri.minX / TILE_SIZE, tx1 = tri.maxX / TILE_SIZE;
+					int ty0 = tri.minY / TILE_SIZE, ty1 = tri.maxY / TILE_SIZE;
+					for (int ty = ty0; ty <= ty1; ty++) {
+						for (int tx = tx0; tx <= tx1; tx++)
+							m_bins[ty * m_tilesX + tx].push_back(&tri);
+					}
+				}
+			}
+
+			setupParticles(viewProj);
+
+			m_pool.run((int)m_bins.size(), [&](int tile, int) { rasterizeTile(tile); });
+		}
+
+		void present(void) {}
+
+		bool savePPM(const char* path) const
+		{
+			FILE* fp = fopen(path, "wb");
+			if (!fp)
+				return false;
+			fprintf(fp, "P6\n%d %d\n255\n", m_width, m_height);
+			std::vector<unsigned char> row(m_width * 3);
+			for (int y = 0; y < m_height; y++) {
+				for (int x = 0; x < m_width; x++) {
+					unsigned int c = m_color[y * m_width + x];
+					row[x * 3 + 0] = (unsigned char)(c >> 16);
+					row[x * 3 + 1] = (unsigned char)(c >> 8);
+					row[x * 3 + 2] = (unsigned char)c;
+				}
+				fwrite(&row[0], row.size(), 1, fp);
+			}
+			return fclose(fp) == 0;
+		}
+
+	private:
+		SoftwareRenderer(const SoftwareRenderer&);
+		SoftwareRenderer& operator=(const SoftwareRenderer&);
+
+		struct Draw
+		{
+			const Mesh* mesh;
+			Matrix      world;
+			Material    mtrl;
+		};
+
+		// a vertex after projection: clip space position and lit color
+		struct ClipVertex
+		{
+			float pos[4];
+			float color[3];
+		};
+
+		// a particle in pixels: the square it covers and its depth
+		struct Splat
+		{
+			int          minX, minY, maxX, maxY;   // empty if minX > maxX
+			float        z;
+			unsigned int rgb;
+		};
+
+		// a triangle in pixels, set up for edge functions
+		struct Triangle
+		{
+			float x[3], y[3];
+			float z[3];         // depth, linear in screen space
+			float invW[3];
+			float color[3][3];  // color / w, for perspective correct interpolation
+			float area;
+			int   minX, minY, maxX, maxY;
+		};
+
+		void setupDraw(const Draw& d, const Matrix& viewProj, const Vec3& eye, std::vector<Triangle>& out)
+		{
+			out.clear();
+			const Mesh& mesh = *d.mesh;
+			const Matrix wvp = d.world * viewProj;
+
+			std::vector<ClipVertex> verts(mesh.vertices.size());
+			for (size_t i = 0; i < mesh.vertices.size(); i++) {
+				const Vertex& v = mesh.vertices[i];
+				transform(v.position, wvp, verts[i].pos);
+				Vec3 p = transformCoord(v.position, d.world);
+				Vec3 n = normalize(transformNormal(v.normal, d.world));
+				lightVertex(m_light, d.mtrl, p, n, eye, verts[i].color);
+			}
+
+			for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+				ClipVertex poly[4];
+				int n = clipNear(verts[mesh.indices[i]], verts[mesh.indices[i + 1]], verts[mesh.indices[i + 2]], poly);
+				for (int k = 1; k + 1 < n; k++)
+					addTriangle(poly[0], poly[k], poly[k + 1], out);
+			}
+		}
+
+		// project the particles on all cores, then bin them in order like the triangles
+		void setupParticles(const Matrix& viewProj)
+		{
+			const int chunk = 4096;
+			m_splats.resize(m_numParticles);
+			m_pool.run((m_numParticles + chunk - 1) / chunk, [&](int c, int) {
+				const int end = (c + 1) * chunk < m_numParticles ? (c + 1) * chunk : m_numParticles;
+				for (int i = c * chunk; i < end; i++)
+					setupSplat(vec3(m_px[i], m_py[i], m_pz[i]), viewProj, m_splats[i]);
+			});
+			for (int i = 0; i < m_numParticles; i++)
+				m_splats[i].rgb = m_prgb[i];
+
+			for (size_t t = 0; t < m_splatBins.size(); t++)
+				m_splatBins[t].clear();
+			for (int i = 0; i < m_numParticles; i++) {
+				const Splat& sp = m_splats[i];
+				if (sp.minX > sp.maxX)
+					continue;
+				for (int ty = sp.minY / TILE_SIZE; ty <= sp.maxY / TILE_SIZE; ty++) {
+					for (int tx = sp.minX / TILE_SIZE; tx <= sp.maxX / TILE_SIZE; tx++)
+						m_splatBins[ty * m_tilesX + tx].push_back(i);
+				}
+			}
+		}
+
+		void setupSplat(const Vec3& p, const Matrix& viewProj, Splat& sp) const
+		{
+			float clip[4];
+			transform(p, viewProj, clip);
+			sp.minX = 1;
+			sp.maxX = 0;
+			if (clip[3] <= 0.0f || clip[2] < 0.0f || clip[2] > clip[3])
+				return;
+			const float invW = 1.0f / clip[3];
+			const float cx = (clip[0] * invW + 1.0f) * 0.5f * m_width;
+			const float cy = (1.0f - clip[1] * invW) * 0.5f * m_height;
+			float half = 0.5f * m_particleSize * m_proj.m[1][1] * 0.5f * m_height * invW;
+			if (half < 0.5f)
+				half = 0.5f;
+			sp.z = clip[2] * invW;
+			sp.minX = (int)std::floor(cx - half + 0.5f);
+			sp.minY = (int)std::floor(cy - half + 0.5f);
+			sp.maxX = (int)std::floor(cx + half - 0.5f);
+			sp.maxY = (int)std::floor(cy + half - 0.5f);
+			if (sp.minX < 0) sp.minX = 0;
+			if (sp.minY < 0) sp.minY = 0;
+			if (sp.maxX > m_width - 1) sp.maxX = m_width - 1;
+			if (sp.maxY > m_height - 1) sp.maxY = m_height - 1;
+			if (sp.minY > sp.maxY)
+				sp.maxX = sp.minX - 1;
+		}
+
+		// clip against the near plane z = 0 of clip space; returns the corners left (0, 3 or 4)
+		static int clipNear(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, ClipVertex out[4])
+		{
+			const ClipVertex* in[3] = { &a, &b, &c };
+			int n = 0;
+			for (int i = 0; i < 3; i++) {
+				const ClipVertex& p = *in[i];
+				const ClipVertex& q = *in[(i + 1) % 3];
+				if (p.pos[2] >= 0.0f)
+					out[n++] = p;
+				if ((p.pos[2] >= 0.0f) != (q.pos[2] >= 0.0f)) {
+					float t = p.pos[2] / (p.pos[2] - q.pos[2]);
+					ClipVertex& r = out[n++];
+					for (int k = 0; k < 4; k++) r.pos[k] = p.pos[k] + t * (q.pos[k] - p.pos[k]);
+					for (int k = 0; k < 3; k++) r.color[k] = p.color[k] + t * (q.color[k] - p.color[k]);
+				}
+			}
+			return n;
+		}
+
+		void addTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, std::vector<Triangle>& out)
+		{
+			const ClipVertex* v[3] = { &a, &b, &c };
+			Triangle t;
+			float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+			for (int i = 0; i < 3; i++) {
+				float w = v[i]->pos[3];
+				if (w <= 0.0f)
+					return;
+				t.invW[i] = 1.0f / w;
+				t.x[i] = (v[i]->pos[0] * t.invW[i] + 1.0f) * 0.5f * m_width;
+				t.y[i] = (1.0f - v[i]->pos[1] * t.invW[i]) * 0.5f * m_height;
+				t.z[i] = v[i]->pos[2] * t.invW[i];
+				for (int k = 0; k < 3; k++)
+					t.color[i][k] = v[i]->color[k] * t.invW[i];
+				if (t.x[i] < minX) minX = t.x[i];
+				if (t.x[i] > maxX) maxX = t.x[i];
+				if (t.y[i] < minY) minY = t.y[i];
+				if (t.y[i] > maxY) maxY = t.y[i];
+			}
+
+			// clockwise on screen is front facing; Direct3D culls the others by default
+			t.area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+			if (t.area <= 0.0f)
+				return;
+
+			// pixel centers at +0.5
+			t.minX = (int)std::floor(minX - 0.5f) + 1;
+			t.minY = (int)std::floor(minY - 0.5f) + 1;
+			t.maxX = (int)std::floor(maxX - 0.5f);
+			t.maxY = (int)std::floor(maxY - 0.5f);
+			if (t.minX < 0) t.minX = 0;
+			if (t.minY < 0) t.minY = 0;
+			if (t.maxX > m_width - 1) t.maxX = m_width - 1;
+			if (t.maxY > m_height - 1) t.maxY = m_height - 1;
+			if (t.minX > t.maxX || t.minY > t.maxY)
+				return;
+			out.push_back(t);
+		}
+
+		// top-left fill rule: pixels exactly on a right or bottom edge are left out, so
+		// neighbouring triangles never both cover a pixel
+		static bool topLeft(float dx, float dy)
+		{
+			return (dy == 0.0f && dx > 0.0f) || dy < 0.0f;
+		}
+
+		void rasterizeTile(int tile)
+		{
+			const int x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+			const int x1 = x0 + TILE_SIZE < m_width ? x0 + TILE_SIZE : m_width;
+			const int y1 = y0 + TILE_SIZE < m_height ? y0 + TILE_SIZE : m_height;
+
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					m_color[y * m_width + x] = m_clear;
+					m_depth[y * m_width + x] = 1.0f;
+				}
+			}
+
+			const std::vector<const Triangle*>& bin = m_bins[tile];
+			for (size_t i = 0; i < bin.size(); i++) {
+				const Triangle& t = *bin[i];
+				int minX = t.minX > x0 ? t.minX : x0, maxX = t.maxX < x1 - 1 ? t.maxX : x1 - 1;
+				int minY = t.minY > y0 ? t.minY : y0, maxY = t.maxY < y1 - 1 ? t.maxY : y1 - 1;
+
+				// edge i is opposite to corner i
+				float ex[3], ey[3];
+				bool  tl[3];
+				for (int e = 0; e < 3; e++) {
+					int a = (e + 1) % 3, b = (e + 2) % 3;
+					ex[e] = t.x[b] - t.x[a];
+					ey[e] = t.y[b] - t.y[a];
+					tl[e] = topLeft(ex[e], ey[e]);
+				}
+				const float invArea = 1.0f / t.area;
+
+				for (int y = minY; y <= maxY; y++) {
+					float py = y + 0.5f;
+					for (int x = minX; x <= maxX; x++) {
+						float px = x + 0.5f;
+						float w[3];
+						bool inside = true;
+						for (int e = 0; e < 3 && inside; e++) {
+							int a = (e + 1) % 3;
+							w[e] = ex[e] * (py - t.y[a]) - ey[e] * (px - t.x[a]);
+							inside = w[e] > 0.0f || (w[e] == 0.0f && tl[e]);
+						}
+						if (!inside)
+							continue;
+						w[0] *= invArea; w[1] *= invArea; w[2] *= invArea;
+
+						float z = w[0] * t.z[0] + w[1] * t.z[1] + w[2] * t.z[2];
+						float& depth = m_depth[y * m_width + x];
+						if (z < 0.0f || z > depth)
+							continue;
+						depth = z;
+
+						float invW = w[0] * t.invW[0] + w[1] * t.invW[1] + w[2] * t.invW[2];
+						unsigned int rgb = 0;
+						for (int k = 0; k < 3; k++) {
+							float c = (w[0] * t.color[0][k] + w[1] * t.color[1][k] + w[2] * t.color[2][k]) / invW;
+							int v = (int)(c * 255.0f + 0.5f);
+							rgb = (rgb << 8) | (unsigned int)(v < 0 ? 0 : (v > 255 ? 255 : v));
+						}
+						m_color[y * m_width + x] = rgb;
+					}
+				}
+			}
+
+			const std::vector<int>& splats = m_splatBins[tile];
+			for (size_t i = 0; i < splats.size(); i++) {
+				const Splat& sp = m_splats[splats[i]];
+				int minX = sp.minX > x0 ? sp.minX : x0, maxX = sp.maxX < x1 - 1 ? sp.maxX : x1 - 1;
+				int minY = sp.minY > y0 ? sp.minY : y0, maxY = sp.maxY < y1 - 1 ? sp.maxY : y1 - 1;
+				for (int y = minY; y <= maxY; y++) {
+					for (int x = minX; x <= maxX; x++) {
+						float& depth = m_depth[y * m_width + x];
+						if (sp.z > depth)
+							continue;
+						depth = sp.z;
+						m_color[y * m_width + x] = sp.rgb;
+					}
+				}
+			}
+		}
+
+		int m_width, m_height;
+		int m_tilesX, m_tilesY;
+		std::vector<unsigned int> m_color;
+		std::vector<float>        m_depth;
+		unsigned int              m_clear;
+
+		Matrix m_view, m_proj;
+		Light  m_light;
+		std::vector<Mesh> m_boxes;
+		Mesh              m_spheres[NUM_SPHERE_LODS];
+
+		std::vector<Draw>                          m_draws;
+		std::vector<std::vector<Triangle> >        m_triangles;   // per draw
+		std::vector<std::vector<const Triangle*> > m_bins;        // per tile
+
+		const float*                  m_px;
+		const float*                  m_py;
+		const float*                  m_pz;
+		const unsigned int*           m_prgb;
+		int                           m_numParticles;
+		float                         m_particleSize;
+		std::vector<Splat>            m_splats;       // per particle
+		std::vector<std::vector<int> > m_splatBins;   // per tile
+		phys::ThreadPool                           m_pool;
+	};
+}
+
+#endif // __legoRasterH__
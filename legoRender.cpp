@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoRender.cpp
+//
+// Desc: Headless screenshots of a level with the software renderer of
+//       legoRaster.h, e.g. on a build server without a GPU. Draws the table the
+//       way the game does, after playing the default shot for a number of ticks,
+//       with the debris of the bricks it broke, and writes the frame as binary PPM.
+//       Without ticks the shot is still being aimed, and its path is drawn dotted.
+//
+//       usage: legoRender [-size WxH] [-threads n] [-ticks n] [-frames n]
+//                         [-o file.ppm] [level]
+//
+//       -frames draws the same frame n times to time the renderer.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoLevel.h"
+#include "legoParticles.h"
+#include "legoPreview.h"
+#include "legoRaster.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// one physics tick of the game: 120 Hz at 0.0007 game time per millisecond
+const float TimeDelta = 0.0007f * 1000.0f / 120.0f;
+
+// the colors of virtualLego.cpp: balls by kind, walls, floor and table
+const unsigned int BallColor[4] = { 0xffff00, 0x0000ff, 0xff00ff, 0xffffff };
+const unsigned int WallColor    = 0xd70000;
+const unsigned int TableColor   = 0x00ff00;
+const float AimDotSpacing = 0.15f;
+const float AimDotRadius  = 0.03f;
+
+struct Table
+{
+	int              plane;
+	std::vector<int> walls;
+	std::vector<int> bricks;    // by ball slot, -1 for round balls
+};
+
+static void createTable(render::Renderer& r, const phys::World& world, Table& table)
+{
+	table.plane = r.createBox(6, 0.03f, 10);
+	table.walls.resize(world.numWalls());
+	for (int i = 0; i < world.numWalls(); i++) {
+		const phys::Wall& w = world.wall(i);
+		table.walls[i] = r.createBox(w.width, w.kind == phys::FLOOR_WALL ? 0.0f : 0.3f, w.depth);
+	}
+	table.bricks.assign(world.numBalls(), -1);
+	for (int i = 0; i < world.numBalls(); i++) {
+		const phys::Ball& b = world.ball(world.ballId(i));
+		if (phys::isBox(b))
+			table.bricks[i] = r.createBox(b.width, phys::BRICK_HEIGHT, b.depth);
+	}
+}
+
+static void drawTable(render::Renderer& r, const phys::World& world, const Table& table,
+	const phys::ParticlePool& particles, const phys::AimPreview& aim)
+{
+	r.beginFrame(render::CLEAR_COLOR);
+	r.drawBox(table.plane, render::translation(0.0f, -0.0006f / 5, 0.0f),
+		render::material(render::colorRGB(TableColor)));
+	for (int i = 0; i < world.numWalls(); i++) {
+		const phys::Wall& w = world.wall(i);
+		unsigned int rgb = w.kind == phys::FLOOR_WALL ? TableColor : WallColor;
+		r.drawBox(table.walls[i], render::translation(w.x, 0.12f, w.z), render::material(render::colorRGB(rgb)));
+	}
+	for (int i = 0; i < world.numBalls(); i++) {
+		const phys::Ball& b = world.ball(world.ballId(i));
+		render::Material mtrl = render::material(render::colorRGB(BallColor[b.kind & 3]));
+		if (table.bricks[i] >= 0)
+			r.drawBox(table.bricks[i], render::translation(b.x, b.y, b.z), mtrl);
+		else
+			r.drawSphere(render::vec3(b.x, b.y, b.z), b.radius, mtrl);
+	}
+	const render::Material dot = render::material(render::color(1, 1, 1));
+	const float y = aim.numLegs() > 0 ? world.ball(world.shot()).y : 0.0f;
+	aim.sample(AimDotSpacing, [&r, &dot, y](float x, float z) {
+		r.drawSphere(render::vec3(x, y, z), AimDotRadius, dot);
+	});
+	r.drawSphere(render::tableLight().position, 0.1f, render::material(render::color(1, 1, 1), 2.0f));
+	r.drawParticles(particles.x(), particles.y(), particles.z(), particles.rgb(), particles.size(), phys::PARTICLE_SIZE);
+	r.endFrame();
+	r.present();
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-size WxH] [-threads n] [-ticks n] [-frames n] [-o file.ppm] [level]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	int width = 1024, height = 768;
+	int threads = 0;
+	int ticks = 0;
+	int frames = 1;
+	const char* out = "frame.ppm";
+	const char* levelFile = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (more && !strcmp(argv[i], "-size") && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) i++;
+		else if (more && !strcmp(argv[i], "-threads")) threads = atoi(argv[++i]);
+		else if (more && !strcmp(argv[i], "-ticks")) ticks = atoi(argv[++i]);
+		else if (more && !strcmp(argv[i], "-frames")) frames = atoi(argv[++i]);
+		else if (more && !strcmp(argv[i], "-o")) out = argv[++i];
+		else if (argv[i][0] != '-' && !levelFile) levelFile = argv[i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (width <= 0 || height <= 0 || frames <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	phys::World world;
+	std::string error;
+	if (!levelFile)
+		phys::setupDefaultLevel(world);
+	else if (!phys::loadLevel(world, levelFile, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	// the shot the game fires at the default aim. the debris flies on after the
+	// level ends, as in the game
+	phys::ParticlePool particles;
+	if (ticks > 0)
+		world.launch();
+	for (int i = 0; i < ticks; i++) {
+		world.step(TimeDelta);
+		for (int b = 0; b < world.numBroken(); b++)
+			particles.burst(world.broken(b), BallColor[phys::BRICK]);
+		particles.update(TimeDelta);
+	}
+	phys::AimPreview aim;
+	aim.update(world);
+
+	render::SoftwareRenderer renderer(width, height, threads);
+	render::Matrix view, proj;
+	render::tableCamera((float)width / (float)height, view, proj);
+	renderer.setCamera(view, proj);
+	renderer.setLight(render::tableLight());
+
+	Table table;
+	createTable(renderer, world, table);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++)
+		drawTable(renderer, world, table, particles, aim);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (!renderer.savePPM(out)) {
+		fprintf(stderr, "can not write %s\n", out);
+		return 1;
+	}
+	printf("image          : %s (%dx%d)\n", out, width, height);
+	printf("threads        : %d\n", renderer.numThreads());
+	printf("particles      : %d\n", particles.size());
+	printf("frame time     : %.2f ms (%d frames)\n", elapsed.count() * 1000.0 / frames, frames);
+	return 0;
+}
@@ -0,0 +1,238 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoRender.h
+//
+// Desc: The renderer interface CSphere, CWall and CLight draw through, so the table can be
+//       drawn by Direct3D (virtualLego.cpp) or by the software rasterizer (legoRaster.h)
+//       on machines without a GPU. Also the meshes both backends share (the math is in
+//       legoMath.h), and the camera and light of the table. No Direct3D dependency.
+//
+//       Conventions are those of Direct3D 9: left-handed coordinates, row vectors
+//       (v * M), clockwise front faces, the fixed-function lighting model.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoRenderH__
+#define __legoRenderH__
+
+#include "legoMath.h"
+#include <cmath>
+#include <vector>
+
+namespace render
+{
+	//
+	// Lighting, as D3DMATERIAL9 and D3DLIGHT9 with a point light
+	//
+
+	struct Color
+	{
+		float r, g, b, a;
+	};
+
+	inline Color color(float r, float g, float b, float a = 1.0f) { Color c = { r, g, b, a }; return c; }
+	inline Color colorRGB(unsigned int rgb)
+	{
+		return color(((rgb >> 16) & 0xff) / 255.0f, ((rgb >> 8) & 0xff) / 255.0f, (rgb & 0xff) / 255.0f);
+	}
+
+	struct Material
+	{
+		Color ambient, diffuse, specular, emissive;
+		float power;
+	};
+
+	// ambient, diffuse and specular all of one color, like the objects of the table
+	inline Material material(const Color& c, float power = 5.0f)
+	{
+		Material m = { c, c, c, color(0, 0, 0), power };
+		return m;
+	}
+
+	struct Light
+	{
+		Vec3  position;
+		Color diffuse, specular, ambient;
+		float range;
+		float attenuation0, attenuation1, attenuation2;
+	};
+
+	// the lit color of a vertex at p with normal n, seen from eye: diffuse and specular
+	// like the fixed-function pipeline with D3DRS_SPECULARENABLE and a local viewer
+	inline void lightVertex(const Light& light, const Material& mtrl, const Vec3& p, const Vec3& n,
+		const Vec3& eye, float out[3])
+	{
+		Vec3 toLight = light.position - p;
+		float d = std::sqrt(dot(toLight, toLight));
+		float atten = 0.0f;
+		if (d <= light.range)
+			atten = 1.0f / (light.attenuation0 + light.attenuation1 * d + light.attenuation2 * d * d);
+		Vec3 l = d > 0.0f ? toLight * (1.0f / d) : vec3(0, 1, 0);
+		Vec3 h = normalize(normalize(eye - p) + l);
+		float diffuse = dot(n, l) > 0.0f ? dot(n, l) : 0.0f;
+		float nh = dot(n, h) > 0.0f ? dot(n, h) : 0.0f;
+		float specular = nh > 0.0f ? std::pow(nh, mtrl.power) : 0.0f;
+
+		const float* la = &light.ambient.r;
+		const float* ld = &light.diffuse.r;
+		const float* ls = &light.specular.r;
+		const float* ma = &mtrl.ambient.r;
+		const float* md = &mtrl.diffuse.r;
+		const float* ms = &mtrl.specular.r;
+		const float* me = &mtrl.emissive.r;
+		for (int i = 0; i < 3; i++) {
+			float c = me[i] + ma[i] * la[i] * atten + md[i] * ld[i] * diffuse * atten;
+			float s = ms[i] * ls[i] * specular * atten;
+			out[i] = (c < 1.0f ? c : 1.0f) + (s < 1.0f ? s : 1.0f);
+		}
+	}
+
+	//
+	// Meshes, built like D3DXCreateSphere and D3DXCreateBox
+	//
+
+	struct Vertex
+	{
+		Vec3 position;
+		Vec3 normal;
+	};
+
+	struct Mesh
+	{
+		std::vector<Vertex>       vertices;
+		std::vector<unsigned int> indices;    // triangle list, clockwise seen from outside
+	};
+
+	inline Mesh makeSphere(float radius, int slices, int stacks)
+	{
+		Mesh mesh;
+		const float pi = 3.14159265f;
+		for (int j = 0; j <= stacks; j++) {
+			float phi = pi * j / stacks;
+			for (int i = 0; i <= slices; i++) {
+				float theta = 2 * pi * i / slices;
+				Vertex v;
+				v.normal = vec3(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+				v.position = v.normal * radius;
+				mesh.vertices.push_back(v);
+			}
+		}
+		for (int j = 0; j < stacks; j++) {
+			for (int i = 0; i < slices; i++) {
+				unsigned int a = j * (slices + 1) + i, b = a + slices + 1;
+				if (j > 0) {
+					mesh.indices.push_back(a); mesh.indices.push_back(a + 1); mesh.indices.push_back(b);
+				}
+				if (j < stacks - 1) {
+					mesh.indices.push_back(a + 1); mesh.indices.push_back(b + 1); mesh.indices.push_back(b);
+				}
+			}
+		}
+		return mesh;
+	}
+
+	inline Mesh makeBox(float width, float height, float depth)
+	{
+		Mesh mesh;
+		const Vec3 h = vec3(width / 2, height / 2, depth / 2);
+		// each face: its normal and two axes spanning it, v x u = normal so the corners
+		// below wind clockwise seen from outside
+		const Vec3 faces[6][3] = {
+			{ vec3( 1, 0, 0), vec3(0, 0, 1), vec3(0, 1, 0) },
+			{ vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) },
+			{ vec3( 0, 1, 0), vec3(1, 0, 0), vec3(0, 0, 1) },
+			{ vec3( 0,-1, 0), vec3(0, 0, 1), vec3(1, 0, 0) },
+			{ vec3( 0, 0, 1), vec3(0, 1, 0), vec3(1, 0, 0) },
+			{ vec3( 0, 0,-1), vec3(1, 0, 0), vec3(0, 1, 0) },
+		};
+		for (int f = 0; f < 6; f++) {
+			const Vec3& n = faces[f][0];
+			const Vec3& u = faces[f][1];
+			const Vec3& v = faces[f][2];
+			unsigned int base = (unsigned int)mesh.vertices.size();
+			const float corners[4][2] = { { -1, -1 }, { -1, 1 }, { 1, 1 }, { 1, -1 } };
+			for (int c = 0; c < 4; c++) {
+				Vec3 p = n + u * corners[c][0] + v * corners[c][1];
+				Vertex vert;
+				vert.position = vec3(p.x * h.x, p.y * h.y, p.z * h.z);
+				vert.normal = n;
+				mesh.vertices.push_back(vert);
+			}
+			const unsigned int tris[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int i = 0; i < 6; i++)
+				mesh.indices.push_back(base + tris[i]);
+		}
+		return mesh;
+	}
+
+	// levels of detail of the ball mesh: slices and stacks of each, and the radius on
+	// screen in pixels down to which each one is used
+	const int   NUM_SPHERE_LODS = 4;
+	const int   SPHERE_LOD_SLICES[NUM_SPHERE_LODS] = { 50, 24, 12, 6 };
+	const float SPHERE_LOD_PIXELS[NUM_SPHERE_LODS] = { 40.0f, 12.0f, 4.0f, 0.0f };
+
+	inline int sphereLod(float pixels)
+	{
+		int lod = 0;
+		while (lod < NUM_SPHERE_LODS - 1 && pixels < SPHERE_LOD_PIXELS[lod])
+			lod++;
+		return lod;
+	}
+
+	//
+	// Renderer
+	//
+
+	class Renderer
+	{
+	public:
+		virtual ~Renderer() {}
+
+		// boxes are the walls, the bricks and the table; the handle stays valid until
+		// destroyMeshes(). boxes of the same size may share one.
+		virtual int  createBox(float width, float height, float depth) = 0;
+		virtual void destroyMeshes(void) = 0;
+
+		virtual void setCamera(const Matrix& view, const Matrix& proj) = 0;
+		virtual void setLight(const Light& light) = 0;
+
+		virtual void beginFrame(unsigned int clearRGB) = 0;
+		virtual void drawBox(int box, const Matrix& world, const Material& mtrl) = 0;
+		// center is in world space; a renderer may batch spheres until endFrame()
+		virtual void drawSphere(const Vec3& center, float radius, const Material& mtrl) = 0;
+		// n unlit squares of edge 'size' facing the camera, colored 0x00RRGGBB, all in one
+		// batch. the arrays must stay as they are until endFrame()
+		virtual void drawParticles(const float* x, const float* y, const float* z,
+			const unsigned int* rgb, int n, float size) = 0;
+		virtual void endFrame(void) = 0;
+		virtual void present(void) = 0;
+	};
+
+	//
+	// The table: camera, light and colors the game sets up in Setup()
+	//
+
+	const unsigned int CLEAR_COLOR = 0xafafaf;
+
+	inline void tableCamera(float aspect, Matrix& view, Matrix& proj)
+	{
+		view = lookAtLH(vec3(0.0f, 10.0f, -8.0f), vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 4.0f, 0.0f));
+		proj = perspectiveFovLH(3.14159265f / 4, aspect, 1.0f, 100.0f);
+	}
+
+	inline Light tableLight(void)
+	{
+		Light lit;
+		lit.position     = vec3(0.0f, 3.0f, 0.0f);
+		lit.diffuse      = color(1, 1, 1);
+		lit.specular     = color(0.9f, 0.9f, 0.9f, 0.9f);
+		lit.ambient      = color(0.9f, 0.9f, 0.9f, 0.9f);
+		lit.range        = 100.0f;
+		lit.attenuation0 = 0.0f;
+		lit.attenuation1 = 0.9f;
+		lit.attenuation2 = 0.0f;
+		return lit;
+	}
+}
+
+#endif // __legoRenderH__
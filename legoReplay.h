@@ -0,0 +1,404 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoReplay.h
+//
+// Desc: Deterministic replays. Every input is stamped with the physics tick it was applied
+//       before, and a hash of the world is stored every few ticks, so a recorded game can
+//       be played back headless at full speed and checked step by step.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoReplayH__
+#define __legoReplayH__
+
+#include "legoPhysics.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace phys
+{
+	//
+	// Input
+	//
+
+	enum InputType
+	{
+		INPUT_PADDLE,   // value: new x of the paddle
+		INPUT_MARKER,   // value: new x of the aiming marker
+		INPUT_LAUNCH,   // fire the shot ball
+		INPUT_MULTIBALL // value: split every shot into this many
+	};
+
+	struct InputEvent
+	{
+		unsigned int tick;
+		int          type;
+		float        value;
+	};
+
+	// the only way input reaches the world, both live and in a replay
+	inline void applyInput(World& world, const InputEvent& e)
+	{
+		int id = -1;
+		switch (e.type) {
+		case INPUT_PADDLE: id = world.paddle(); break;
+		case INPUT_MARKER: id = world.marker(); break;
+		case INPUT_LAUNCH: world.launch(); return;
+		case INPUT_MULTIBALL: world.splitShots((int)e.value); return;
+		}
+		if (id < 0)
+			return;
+		Ball b = world.ball(id);
+		world.setCenter(id, e.value, b.y, b.z);
+	}
+
+	//
+	// State hash
+	//
+
+	inline unsigned long long hashBytes(unsigned long long h, const void* data, size_t bytes)
+	{
+		// FNV-1a
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < bytes; i++) {
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	inline unsigned long long hashWorld(const World& world)
+	{
+		const BallStore& b = world.balls();
+		const size_t n = (size_t)b.size() * sizeof(float);
+		int progress[2] = { (int)world.state(), world.cleared() };
+
+		unsigned long long h = 14695981039346656037ULL;
+		h = hashBytes(h, b.x.data(),  n);
+		h = hashBytes(h, b.z.data(),  n);
+		h = hashBytes(h, b.vx.data(), n);
+		h = hashBytes(h, b.vz.data(), n);
+		h = hashBytes(h, progress, sizeof(progress));
+		return h;
+	}
+
+	struct StateHash
+	{
+		unsigned int       tick;
+		unsigned long long hash;
+	};
+
+	//
+	// Little endian bytes, whatever the byte order of the host
+	//
+
+	inline void putU32(std::vector<unsigned char>& out, unsigned int v)
+	{
+		for (int i = 0; i < 4; i++)
+			out.push_back((unsigned char)(v >> (8 * i)));
+	}
+
+	inline void putU64(std::vector<unsigned char>& out, unsigned long long v)
+	{
+		putU32(out, (unsigned int)v);
+		putU32(out, (unsigned int)(v >> 32));
+	}
+
+	inline void putF32(std::vector<unsigned char>& out, float f)
+	{
+		unsigned int v;
+		memcpy(&v, &f, 4);
+		putU32(out, v);
+	}
+
+	class ByteReader
+	{
+	public:
+		explicit ByteReader(const std::vector<unsigned char>& data) : m_data(data), m_read(0) {}
+
+		size_t left(void) const { return m_data.size() - m_read; }
+
+		bool getU32(unsigned int& v)
+		{
+			if (left() < 4)
+				return false;
+			v = 0;
+			for (int i = 0; i < 4; i++)
+				v |= (unsigned int)m_data[m_read++] << (8 * i);
+			return true;
+		}
+
+		bool getU64(unsigned long long& v)
+		{
+			unsigned int lo, hi;
+			if (!getU32(lo) || !getU32(hi))
+				return false;
+			v = ((unsigned long long)hi << 32) | lo;
+			return true;
+		}
+
+		bool getF32(float& f)
+		{
+			unsigned int v;
+			if (!getU32(v))
+				return false;
+			memcpy(&f, &v, 4);
+			return true;
+		}
+
+		bool getBytes(void* data, size_t bytes)
+		{
+			if (left() < bytes)
+				return false;
+			if (bytes)
+				memcpy(data, &m_data[m_read], bytes);
+			m_read += bytes;
+			return true;
+		}
+
+	private:
+		const std::vector<unsigned char>& m_data;
+		size_t                            m_read;
+	};
+
+	//
+	// Replay
+	//
+
+	class Replay
+	{
+	public:
+		Replay() { begin(); }
+
+		// start a new recording of a world that was just set up. level names the level
+		// file the world was loaded from; empty for the default level.
+		void begin(unsigned int hashInterval = 60, const std::string& level = "")
+		{
+			m_timeDelta = 0.0f;
+			m_hashInterval = hashInterval ? hashInterval : 1;
+			m_numTicks = 0;
+			m_level = level;
+			m_events.clear();
+			m_hashes.clear();
+		}
+
+		// apply an input to the world and log it
+		void input(World& world, int type, float value = 0.0f)
+		{
+			InputEvent e;
+			e.tick  = m_numTicks;
+			e.type  = type;
+			e.value = value;
+			m_events.push_back(e);
+			applyInput(world, e);
+		}
+
+		// advance the world one tick and log its hash when due. the replay is only
+		// exact if timeDelta is the same on every tick.
+		void step(World& world, float timeDelta)
+		{
+			m_timeDelta = timeDelta;
+			world.step(m_timeDelta);
+			if (++m_numTicks % m_hashInterval == 0) {
+				StateHash s;
+				s.tick = m_numTicks;
+				s.hash = hashWorld(world);
+				m_hashes.push_back(s);
+			}
+		}
+
+		// forget everything after tick, e.g. when the world was rolled back to it. the
+		// recording then goes on from there as if that had never happened.
+		void rewind(unsigned int tick)
+		{
+			if (tick > m_numTicks)
+				return;
+			m_numTicks = tick;
+			while (!m_events.empty() && m_events.back().tick >= tick)
+				m_events.pop_back();
+			while (!m_hashes.empty() && m_hashes.back().tick > tick)
+				m_hashes.pop_back();
+		}
+
+		float        timeDelta(void)    const { return m_timeDelta; }
+		unsigned int hashInterval(void) const { return m_hashInterval; }
+		unsigned int numTicks(void)     const { return m_numTicks; }
+		const std::string& level(void)  const { return m_level; }
+		const std::vector<InputEvent>& events(void) const { return m_events; }
+		const std::vector<StateHash>&  hashes(void) const { return m_hashes; }
+
+		//
+		// File: "LGRP", version, header, level name, events, hashes. little endian. a
+		// replay only loads in a build of the same REAL_FORMAT, float or fixed point.
+		//
+
+		bool save(const char* path) const
+		{
+			std::vector<unsigned char> out;
+			out.insert(out.end(), "LGRP", "LGRP" + 4);
+			const unsigned int header[7] = { VERSION, m_hashInterval, m_numTicks,
+				(unsigned int)m_level.size(), (unsigned int)m_events.size(), (unsigned int)m_hashes.size(),
+				REAL_FORMAT };
+			for (int i = 0; i < 7; i++)
+				putU32(out, header[i]);
+			putF32(out, m_timeDelta);
+			out.insert(out.end(), m_level.begin(), m_level.end());
+			for (size_t i = 0; i < m_events.size(); i++) {
+				const InputEvent& e = m_events[i];
+				putU32(out, e.tick);
+				putU32(out, (unsigned int)e.type);
+				putF32(out, e.value);
+			}
+			for (size_t i = 0; i < m_hashes.size(); i++) {
+				putU32(out, m_hashes[i].tick);
+				putU64(out, m_hashes[i].hash);
+			}
+
+			FILE* fp = fopen(path, "wb");
+			if (!fp)
+				return false;
+			bool ok = fwrite(&out[0], out.size(), 1, fp) == 1;
+			return fclose(fp) == 0 && ok;
+		}
+
+		// the counts in the file are checked against its size before anything is
+		// allocated for them, so a damaged file fails instead of asking for gigabytes
+		bool load(const char* path)
+		{
+			std::vector<unsigned char> data;
+			FILE* fp = fopen(path, "rb");
+			if (!fp)
+				return false;
+			unsigned char buffer[4096];
+			size_t n;
+			while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+				data.insert(data.end(), buffer, buffer + n);
+			fclose(fp);
+
+			ByteReader in(data);
+			char magic[4];
+			unsigned int header[7];
+			bool ok = in.getBytes(magic, 4) && memcmp(magic, "LGRP", 4) == 0;
+			for (int i = 0; ok && i < 7; i++)
+				ok = in.getU32(header[i]);
+			ok = ok && header[0] == VERSION && header[6] == REAL_FORMAT && header[1] > 0 && in.getF32(m_timeDelta)
+				&& header[3] <= in.left()
+				&& header[4] <= (in.left() - header[3]) / EVENT_BYTES
+				&& header[5] <= (in.left() - header[3] - header[4] * (size_t)EVENT_BYTES) / HASH_BYTES;
+			if (ok) {
+				m_hashInterval = header[1];
+				m_numTicks = header[2];
+				m_level.assign(header[3], '\0');
+				m_events.resize(header[4]);
+				m_hashes.resize(header[5]);
+				ok = m_level.empty() || in.getBytes(&m_level[0], m_level.size());
+			}
+			for (size_t i = 0; ok && i < m_events.size(); i++) {
+				InputEvent& e = m_events[i];
+				unsigned int type = 0;
+				ok = in.getU32(e.tick) && in.getU32(type) && in.getF32(e.value);
+				e.type = (int)type;
+			}
+			for (size_t i = 0; ok && i < m_hashes.size(); i++) {
+				StateHash& s = m_hashes[i];
+				ok = in.getU32(s.tick) && in.getU64(s.hash);
+			}
+			if (!ok)
+				begin();
+			return ok;
+		}
+
+		//
+		// Playback
+		//
+
+		// run the recording on a world set up like the recorded one. returns the first
+		// tick whose hash differs from the recording, or 0 if all of them match.
+		unsigned int play(World& world) const
+		{
+			size_t e = 0, h = 0;
+			for (unsigned int tick = 0; tick < m_numTicks; tick++) {
+				for (; e < m_events.size() && m_events[e].tick <= tick; e++)
+					applyInput(world, m_events[e]);
+				world.step(m_timeDelta);
+				if (h < m_hashes.size() && m_hashes[h].tick == tick + 1) {
+					if (m_hashes[h].hash != hashWorld(world))
+						return tick + 1;
+					h++;
+				}
+			}
+			// input after the last tick, e.g. a launch right before quitting
+			for (; e < m_events.size(); e++)
+				applyInput(world, m_events[e]);
+			return 0;
+		}
+
+	private:
+		enum { VERSION = 6, EVENT_BYTES = 12, HASH_BYTES = 12 };
+
+		float        m_timeDelta;
+		unsigned int m_hashInterval;
+		unsigned int m_numTicks;
+		std::string  m_level;
+		std::vector<InputEvent> m_events;
+		std::vector<StateHash>  m_hashes;
+	};
+
+	//
+	// History: snapshots of a recorded game, to go back in it. undo() rolls back a number
+	// of ticks, retry() to just before the shot. The replay is rewound along with the
+	// world, so it still plays back to the same state.
+	//
+
+	class History
+	{
+	public:
+		explicit History(int ticks = 256) : m_ring(ticks) {}
+
+		// forget the game so far, e.g. for a new level
+		void clear(void)
+		{
+			m_ring.clear();
+			m_ready.begin();
+		}
+
+		// call before each step with the replay the world is recorded with
+		void record(const World& world, const Replay& replay)
+		{
+			world.save(m_ring.push(), replay.numTicks());
+			if (world.state() == World::READY)
+				world.save(m_ready, replay.numTicks());
+		}
+
+		// roll back 'ticks' ticks, or as far as the snapshots go
+		bool undo(World& world, Replay& replay, unsigned int ticks)
+		{
+			unsigned int now = replay.numTicks();
+			const Snapshot* s = m_ring.find(ticks < now ? now - ticks : 0);
+			return s && rollback(world, replay, *s);
+		}
+
+		// back to the last tick before the shot was fired
+		bool retry(World& world, Replay& replay)
+		{
+			return !m_ready.empty() && rollback(world, replay, m_ready);
+		}
+
+	private:
+		bool rollback(World& world, Replay& replay, const Snapshot& s)
+		{
+			if (!world.restore(s))
+				return false;
+			replay.rewind(s.tick());
+			m_ring.truncate(s.tick());
+			return true;
+		}
+
+		SnapshotRing m_ring;
+		Snapshot     m_ready;    // the last one taken while aiming
+	};
+}
+
+#endif // __legoReplayH__
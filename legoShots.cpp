@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoShots.cpp
+//
+// Desc: Monte-Carlo shot evaluator for level balancing. Sweeps launch angles
+//       and powers, plays every shot to the end on all cores (one world copy
+//       per thread) and reports how many bricks each one clears and how fast.
+//
+//       usage: legoShots [-angles from:to:count] [-powers from:to:count]
+//                        [-threads n] [-ticks max] [-csv file] [-level file]
+//
+//       angles are in degrees from the +x axis, powers are shot speeds. the
+//       game's default aim launches at about 90 degrees with power 2.8.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoLevel.h"
+#include "legoThreads.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// one physics tick of the game: 120 Hz at 0.0007 game time per millisecond
+const float TickRate  = 120.0f;
+const float TimeDelta = 0.0007f * 1000.0f / TickRate;
+
+struct Range
+{
+	float from, to;
+	int   count;
+
+	float at(int i) const { return count > 1 ? from + (to - from) * i / (count - 1) : from; }
+};
+
+struct Shot
+{
+	float angle, power;
+	int   cleared;
+	int   ticks;
+	int   state;
+};
+
+static bool parseRange(const char* s, Range& r)
+{
+	return sscanf(s, "%f:%f:%d", &r.from, &r.to, &r.count) == 3 && r.count > 0;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "usage: %s [-angles from:to:count] [-powers from:to:count]"
+		" [-threads n] [-ticks max] [-csv file] [-level file]\n", name);
+}
+
+int main(int argc, char* argv[])
+{
+	Range angles = { 20.0f, 160.0f, 1000 };
+	Range powers = { 1.0f, 4.0f, 10 };
+	int threads  = 0;
+	int maxTicks = 120 * 60;    // give up after a minute of play
+	const char* csv = NULL;
+	const char* levelFile = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		bool more = i + 1 < argc;
+		if (more && !strcmp(argv[i], "-angles") && parseRange(argv[i + 1], angles)) i++;
+		else if (more && !strcmp(argv[i], "-powers") && parseRange(argv[i + 1], powers)) i++;
+		else if (more && !strcmp(argv[i], "-threads")) threads = atoi(argv[++i]);
+		else if (more && !strcmp(argv[i], "-ticks")) maxTicks = atoi(argv[++i]);
+		else if (more && !strcmp(argv[i], "-csv")) csv = argv[++i];
+		else if (more && !strcmp(argv[i], "-level")) levelFile = argv[++i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	phys::World level;
+	std::string error;
+	if (!levelFile)
+		phys::setupDefaultLevel(level);
+	else if (!phys::loadLevel(level, levelFile, error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	// every shot starts from the same snapshot of the level, restored into the
+	// worker's own world
+	phys::ThreadPool pool(threads);
+	std::vector<phys::World> worlds(pool.size(), level);
+	phys::Snapshot initial;
+	level.save(initial);
+	std::vector<Shot> shots(angles.count * powers.count);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pool.run((int)shots.size(), [&](int task, int worker) {
+		Shot& shot = shots[task];
+		shot.angle = angles.at(task / powers.count);
+		shot.power = powers.at(task % powers.count);
+
+		phys::World& world = worlds[worker];
+		world.restore(initial);
+		float rad = shot.angle * 3.14159265f / 180.0f;
+		world.launch(shot.power * std::cos(rad), shot.power * std::sin(rad));
+
+		int ticks = 0;
+		while (world.state() == phys::World::PLAYING && ticks < maxTicks) {
+			world.step(TimeDelta);
+			ticks++;
+		}
+		shot.cleared = world.cleared();
+		shot.ticks = ticks;
+		shot.state = world.state();
+	});
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	if (csv) {
+		FILE* fp = fopen(csv, "w");
+		if (!fp) {
+			fprintf(stderr, "can not write %s\n", csv);
+			return 1;
+		}
+		fprintf(fp, "angle,power,cleared,seconds,result\n");
+		for (size_t i = 0; i < shots.size(); i++) {
+			const Shot& s = shots[i];
+			fprintf(fp, "%g,%g,%d,%.3f,%s\n", s.angle, s.power, s.cleared, s.ticks / TickRate,
+				s.state == phys::World::CLEARED ? "cleared" : (s.state == phys::World::FAILED ? "failed" : "timeout"));
+		}
+		fclose(fp);
+	}
+
+	// summary: clear rate, bricks per shot and the fastest full clears
+	std::vector<Shot> clears;
+	long long bricks = 0;
+	for (size_t i = 0; i < shots.size(); i++) {
+		bricks += shots[i].cleared;
+		if (shots[i].state == phys::World::CLEARED)
+			clears.push_back(shots[i]);
+	}
+	std::sort(clears.begin(), clears.end(), [](const Shot& a, const Shot& b) { return a.ticks < b.ticks; });
+
+	printf("shots          : %d (%d angles x %d powers)\n", (int)shots.size(), angles.count, powers.count);
+	printf("threads        : %d\n", pool.size());
+	printf("time           : %.3f s (%.0f shots/s)\n", elapsed.count(), shots.size() / elapsed.count());
+	printf("full clears    : %d (%.1f%%)\n", (int)clears.size(), 100.0 * clears.size() / shots.size());
+	printf("bricks / shot  : %.2f of %d\n", (double)bricks / shots.size(), level.numBricks());
+	for (size_t i = 0; i < clears.size() && i < 5; i++) {
+		printf("fastest #%d     : angle %.2f power %.2f, %.2f s\n", (int)i + 1,
+			clears[i].angle, clears[i].power, clears[i].ticks / TickRate);
+	}
+#if defined(PHYS_PROFILE)
+	printf("\n%s", phys::profiler().report().c_str());
+#endif
+	return 0;
+}
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoSim.cpp
+//
+// Desc: Headless batch simulation of Virtual Billiard on top of legoPhysics.h.
+//       Plays the default level with a given aim as fast as possible and
+//       reports the outcome and how much faster than real-time it ran.
+//
+//       usage: legoSim [aim_x] [games] [time_delta] [level]
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "legoLevel.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// the game gives up on a shot that is still bouncing after this many steps
+const int MAX_STEPS = 1000000;
+
+static const char* stateName(phys::World::State state)
+{
+	switch (state) {
+	case phys::World::READY:   return "ready";
+	case phys::World::PLAYING: return "playing";
+	case phys::World::CLEARED: return "cleared";
+	case phys::World::FAILED:  return "failed";
+	}
+	return "?";
+}
+
+// play one game; returns the number of steps taken
+static int playGame(phys::World& world, const phys::World& level, float aimX, float timeDelta)
+{
+	world = level;
+	world.setCenter(world.marker(), aimX, phys::BALL_RADIUS, world.ball(world.marker()).z);
+	world.launch();
+
+	int steps = 0;
+	while (world.state() == phys::World::PLAYING && steps < MAX_STEPS) {
+		world.step(timeDelta);
+		steps++;
+	}
+	return steps;
+}
+
+int main(int argc, char* argv[])
+{
+	float aimX      = argc > 1 ? (float)atof(argv[1]) : 0.5f;
+	int   games     = argc > 2 ? atoi(argv[2]) : 1000;
+	// by default the step of the game: 120 Hz at 0.0007 game time per millisecond
+	float timeDelta = argc > 3 ? (float)atof(argv[3]) : 0.0007f * 1000.0f / 120.0f;
+
+	if (games <= 0 || timeDelta <= 0.0f) {
+		fprintf(stderr, "usage: %s [aim_x] [games] [time_delta] [level]\n", argv[0]);
+		return 1;
+	}
+
+	phys::World level;
+	std::string error;
+	if (argc > 4) {
+		if (!phys::loadLevel(level, argv[4], error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+	else {
+		phys::setupDefaultLevel(level);
+	}
+
+	phys::World world;
+	long long totalSteps = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < games; i++)
+		totalSteps += playGame(world, level, aimX, timeDelta);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// EnterMsgLoop scales milliseconds by 0.0007 into timeDelta
+	double simSeconds = (double)totalSteps * timeDelta / 0.7;
+
+	printf("aim x          : %g\n", aimX);
+	printf("result         : %s (%d/%d bricks)\n",
+		stateName(world.state()), world.cleared(), world.numBricks());
+	printf("steps per game : %lld\n", totalSteps / games);
+	printf("games          : %d in %.3f s\n", games, elapsed.count());
+	printf("speed          : %.0fx real-time\n",
+		elapsed.count() > 0.0 ? simSeconds / elapsed.count() : 0.0);
+#if defined(PHYS_PROFILE)
+	printf("\n%s", phys::profiler().report().c_str());
+#endif
+	return 0;
+}
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoSnapshot.h
+//
+// Desc: Flat snapshots of the world (see World::save and World::restore). A snapshot is
+//       one byte buffer the state is copied into array by array with memcpy; it keeps
+//       its memory, so taking one every tick does not allocate once it has grown.
+//       SnapshotRing keeps the most recent ones for rolling back.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoSnapshotH__
+#define __legoSnapshotH__
+
+#include <cstring>
+#include <vector>
+
+namespace phys
+{
+	class Snapshot
+	{
+	public:
+		Snapshot() : m_size(0), m_tick(0) {}
+
+		// start over, keeping the memory
+		void begin(unsigned int tick = 0)
+		{
+			m_size = 0;
+			m_tick = tick;
+		}
+
+		void put(const void* data, size_t bytes)
+		{
+			if (m_size + bytes > m_data.size())
+				m_data.resize((m_size + bytes) * 2);
+			if (bytes)
+				memcpy(&m_data[m_size], data, bytes);
+			m_size += bytes;
+		}
+
+		// an AlignedArray or std::vector of POD: its size, then its elements
+		template<class A>
+		void putArray(const A& a)
+		{
+			size_t n = a.size();
+			put(&n, sizeof(n));
+			put(a.data(), n * sizeof(a[0]));
+		}
+
+		size_t size(void) const { return m_size; }
+		bool empty(void) const { return m_size == 0; }
+		unsigned int tick(void) const { return m_tick; }   // what begin() was given
+		const char* data(void) const { return m_data.empty() ? 0 : &m_data[0]; }
+
+	private:
+		std::vector<char> m_data;
+		size_t            m_size;
+		unsigned int      m_tick;
+	};
+
+	// reads a snapshot back in the order it was written
+	class SnapshotReader
+	{
+	public:
+		explicit SnapshotReader(const Snapshot& s) : m_data(s.data()), m_size(s.size()), m_read(0) {}
+
+		bool get(void* data, size_t bytes)
+		{
+			if (m_read + bytes > m_size)
+				return false;
+			if (bytes)
+				memcpy(data, m_data + m_read, bytes);
+			m_read += bytes;
+			return true;
+		}
+
+		template<class A>
+		bool getArray(A& a)
+		{
+			size_t n;
+			if (!get(&n, sizeof(n)) || m_read + n * sizeof(a[0]) > m_size)
+				return false;
+			a.resize(n);
+			return get(a.data(), n * sizeof(a[0]));
+		}
+
+	private:
+		const char* m_data;
+		size_t      m_size;
+		size_t      m_read;
+	};
+
+	//
+	// SnapshotRing: the last size() snapshots, the oldest overwritten first
+	//
+
+	class SnapshotRing
+	{
+	public:
+		explicit SnapshotRing(int size = 256) : m_ring(size > 0 ? size : 1), m_next(0), m_count(0) {}
+
+		// the snapshot to fill next; it becomes the newest
+		Snapshot& push(void)
+		{
+			Snapshot& s = m_ring[m_next];
+			m_next = (m_next + 1) % (int)m_ring.size();
+			if (m_count < (int)m_ring.size())
+				m_count++;
+			return s;
+		}
+
+		// the newest snapshot taken at or before tick; 0 if none is left
+		const Snapshot* find(unsigned int tick) const
+		{
+			for (int i = 0; i < m_count; i++) {
+				const Snapshot& s = at(i);
+				if (s.tick() <= tick)
+					return &s;
+			}
+			return 0;
+		}
+
+		// forget the snapshots after tick, e.g. once the world went back there
+		void truncate(unsigned int tick)
+		{
+			while (m_count > 0 && at(0).tick() > tick) {
+				m_next = (m_next + (int)m_ring.size() - 1) % (int)m_ring.size();
+				m_count--;
+			}
+		}
+
+		void clear(void) { m_next = m_count = 0; }
+
+		int size(void)  const { return (int)m_ring.size(); }
+		int count(void) const { return m_count; }
+
+	private:
+		// i = 0 is the newest
+		const Snapshot& at(int i) const
+		{
+			const int n = (int)m_ring.size();
+			return m_ring[(m_next - 1 - i + 2 * n) % n];
+		}
+
+		std::vector<Snapshot> m_ring;
+		int                   m_next;
+		int                   m_count;
+	};
+}
+
+#endif // __legoSnapshotH__
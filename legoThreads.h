@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoThreads.h
+//
+// Desc: A small persistent thread pool. run() hands out task indices to every worker
+//       (the calling thread included) through an atomic counter and returns when all
+//       tasks are done.
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoThreadsH__
+#define __legoThreadsH__
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace phys
+{
+	class ThreadPool
+	{
+	public:
+		// numThreads = 0 uses one thread per hardware thread
+		explicit ThreadPool(int numThreads = 0)
+			: m_job(0), m_count(0), m_busy(0), m_generation(0), m_quit(false)
+		{
+			if (numThreads <= 0)
+				numThreads = (int)std::thread::hardware_concurrency();
+			if (numThreads <= 0)
+				numThreads = 1;
+			m_next = 0;
+			for (int i = 1; i < numThreads; i++)
+				m_threads.push_back(std::thread(&ThreadPool::work, this, i));
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_quit = true;
+			}
+			m_wake.notify_all();
+			for (size_t i = 0; i < m_threads.size(); i++)
+				m_threads[i].join();
+		}
+
+		// number of workers, the calling thread included
+		int size(void) const { return (int)m_threads.size() + 1; }
+
+		// call f(task, worker) for every task in [0, count). worker is in [0, size())
+		// and tells which thread runs the task, e.g. to pick per-thread scratch data.
+		template<class F>
+		void run(int count, F f)
+		{
+			if (count <= 0)
+				return;
+			std::function<void(int, int)> job(f);
+			if (m_threads.empty() || count == 1) {
+				for (int i = 0; i < count; i++)
+					job(i, 0);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_job = &job;
+				m_count = count;
+				m_next = 0;
+				m_busy = (int)m_threads.size();
+				m_generation++;
+			}
+			m_wake.notify_all();
+			drain(0);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_done.wait(lock, [this] { return m_busy == 0; });
+			m_job = 0;
+		}
+
+	private:
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+
+		void drain(int worker)
+		{
+			for (int i = m_next++; i < m_count; i = m_next++)
+				(*m_job)(i, worker);
+		}
+
+		void work(int worker)
+		{
+			unsigned int seen = 0;
+			for (;;) {
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+					if (m_quit)
+						return;
+					seen = m_generation;
+				}
+				drain(worker);
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					if (--m_busy == 0)
+						m_done.notify_one();
+				}
+			}
+		}
+
+		std::vector<std::thread>        m_threads;
+		std::mutex                      m_mutex;
+		std::condition_variable         m_wake, m_done;
+		std::function<void(int, int)>*  m_job;
+		std::atomic<int>                m_next;
+		int                             m_count;
+		int                             m_busy;
+		unsigned int                    m_generation;
+		bool                            m_quit;
+	};
+}
+
+#endif // __legoThreadsH__
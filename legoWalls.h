@@ -0,0 +1,381 @@
+//////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// File: legoWalls.h
+//
+// Desc: Walls as axis-aligned boxes for the physics core. Each wall collides by its own
+//       position and size, so an arena may have walls anywhere, obstacles inside it
+//       included. The boxes are kept as a structure of arrays for two SIMD kernels:
+//       sweepWalls() moves one ball past all walls at once (walls as lanes) and
+//       collideWalls() pushes many balls out of the walls (balls as lanes).
+//
+//////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __legoWallsH__
+#define __legoWallsH__
+
+#include "legoBalls.h"
+#include <cfloat>
+#include <cmath>
+
+namespace phys
+{
+	//
+	// One box. written for float and Fixed alike (see legoFixed.h)
+	//
+
+	// does a ball at (x,z) of radius r overlap the box?
+	template<class T>
+	inline bool touchBox(T x, T z, T r, T minX, T maxX, T minZ, T maxZ)
+	{
+		T ox = x - (x < minX ? minX : (x > maxX ? maxX : x));
+		T oz = z - (z < minZ ? minZ : (z > maxZ ? maxZ : z));
+		return ox * ox + oz * oz < r * r;
+	}
+
+	// unit normal of the box surface nearest to (x,z), pointing out of the box. from
+	// the closest point of the box, or from the nearest face when (x,z) is inside it.
+	template<class T>
+	inline void boxNormal(T x, T z, T minX, T maxX, T minZ, T maxZ, T& nx, T& nz)
+	{
+		const T zero(0.0f), one(1.0f);
+		T ox = x - (x < minX ? minX : (x > maxX ? maxX : x));
+		T oz = z - (z < minZ ? minZ : (z > maxZ ? maxZ : z));
+		// off a face rather than a corner: no square root needed
+		if ((ox == zero) != (oz == zero)) {
+			nx = ox > zero ? one : (ox < zero ? -one : zero);
+			nz = oz > zero ? one : (oz < zero ? -one : zero);
+			return;
+		}
+		T d = norm(ox, oz);
+		if (d > zero) {
+			nx = ox / d;
+			nz = oz / d;
+			return;
+		}
+		T left = x - minX, right = maxX - x, bottom = z - minZ, top = maxZ - z;
+		T m = left < right ? left : right;
+		m = bottom < m ? bottom : m;
+		m = top < m ? top : m;
+		nx = m == left ? -one : (m == right ? one : zero);
+		nz = nx != zero ? zero : (m == bottom ? -one : one);
+	}
+
+	// if a ball at (x,z) of radius r overlaps the box, move it out to just touch it and
+	// reflect the part of its velocity heading into the box. returns whether it did.
+	template<class T>
+	inline bool pushOutOfBox(T& x, T& z, T& vx, T& vz, T r, T minX, T maxX, T minZ, T maxZ)
+	{
+		if (!touchBox(x, z, r, minX, maxX, minZ, maxZ))
+			return false;
+		const T zero(0.0f), two(2.0f);
+		T nx, nz;
+		boxNormal(x, z, minX, maxX, minZ, maxZ, nx, nz);
+		// the point of the box nearest to the ball, then r away from it along the normal
+		T cx = x < minX ? minX : (x > maxX ? maxX : x);
+		T cz = z < minZ ? minZ : (z > maxZ ? maxZ : z);
+		if (cx == x && cz == z) {
+			cx = nx < zero ? minX : (nx > zero ? maxX : x);
+			cz = nz < zero ? minZ : (nz > zero ? maxZ : z);
+		}
+		x = cx + r * nx;
+		z = cz + r * nz;
+		T vn = vx * nx + vz * nz;
+		if (vn < zero) {
+			vx -= two * vn * nx;
+			vz -= two * vn * nz;
+		}
+		return true;
+	}
+
+	// pushOutOfBox on a ball kept in floats, done in Real
+	inline bool pushOutOfBoxReal(float& x, float& z, float& vx, float& vz, float r,
+		float minX, float maxX, float minZ, float maxZ)
+	{
+		Real bx(x), bz(z), bvx(vx), bvz(vz);
+		if (!pushOutOfBox<Real>(bx, bz, bvx, bvz, Real(r), Real(minX), Real(maxX), Real(minZ), Real(maxZ)))
+			return false;
+		x = toFloat(bx); z = toFloat(bz);
+		vx = toFloat(bvx); vz = toFloat(bvz);
+		return true;
+	}
+
+	inline bool pushOutOfBox(float& x, float& z, float& vx, float& vz, float r,
+		float minX, float maxX, float minZ, float maxZ)
+	{
+#if defined(PHYS_FIXED)
+		// most balls are nowhere near the box: rule those out in float, with some slack,
+		// here where the caller inlines it
+		if (!touchBox(x, z, r + 1e-3f, minX, maxX, minZ, maxZ))
+			return false;
+#endif
+		return pushOutOfBoxReal(x, z, vx, vz, r, minX, maxX, minZ, maxZ);
+	}
+
+	// fraction t in [0,1] of the move (dx,dz) at which a ball first touches a circle,
+	// (mx,mz) being the ball's center less the circle's and r the sum of both radii. 0
+	// if they touch already, -1 if they do not meet or the ball moves away.
+	inline float circleTime(float mx, float mz, float dx, float dz, float r)
+	{
+		float b = mx * dx + mz * dz;
+		if (b >= 0.0f)
+			return -1.0f;
+		float c = mx * mx + mz * mz - r * r;
+		if (c <= 0.0f)
+			return 0.0f;
+		float a = dx * dx + dz * dz;
+		float disc = b * b - a * c;
+		if (disc < 0.0f)
+			return -1.0f;
+		// c / (-b + sqrt(disc)) is the smaller root without the cancellation of -b - sqrt(disc)
+		float t = c / (-b + std::sqrt(disc));
+		return t <= 1.0f ? t : -1.0f;
+	}
+
+	// the same in fixed point. the squares of a short move would lose most of their
+	// bits, so the quadratic is solved along the unit direction of the move instead, for
+	// the distance s to the contact, and the dot products are taken in 64 bits.
+	inline Fixed circleTime(Fixed mx, Fixed mz, Fixed dx, Fixed dz, Fixed r)
+	{
+		const long long b = (long long)mx.raw * dx.raw + (long long)mz.raw * dz.raw;
+		if (b >= 0)
+			return Fixed(-1.0f);
+		const long long c = (long long)mx.raw * mx.raw + (long long)mz.raw * mz.raw - (long long)r.raw * r.raw;
+		if (c <= 0)
+			return Fixed(0.0f);
+		const Fixed length = norm(dx, dz);
+		const Fixed along = Fixed::fromRaw((int)(b / length.raw));    // m . d / |d|
+		const Fixed disc = along * along - Fixed::fromRaw((int)(c >> 16));
+		if (disc < Fixed(0.0f))
+			return Fixed(-1.0f);
+		Fixed s = -along - sqrtOf(disc);
+		if (s < Fixed(0.0f))
+			s = Fixed(0.0f);
+		const Fixed t = s / length;
+		return t <= Fixed(1.0f) ? t : Fixed(-1.0f);
+	}
+
+	// fraction t in [0,1] of the move (dx,dz) at which a ball at (x,z) of radius r first
+	// touches the box, and the normal there. -1 if it does not, or if it touches already
+	// and moves away. the box grown by r has rounded corners, which are swept as circles.
+	template<class T>
+	inline T sweepBox(T x, T z, T dx, T dz, T r, T minX, T maxX, T minZ, T maxZ, T& nx, T& nz)
+	{
+		const T zero(0.0f), one(1.0f), none(-1.0f);
+		if (touchBox(x, z, r, minX, maxX, minZ, maxZ)) {
+			boxNormal(x, z, minX, maxX, minZ, maxZ, nx, nz);
+			return dx * nx + dz * nz < zero ? zero : none;
+		}
+		if (dx == zero && dz == zero)
+			return none;
+
+		// slabs of the grown box
+		T enter = -largest(zero), exit = largest(zero);
+		bool alongX = false;
+		if (dx != zero) {
+			T a = (minX - r - x) / dx, b = (maxX + r - x) / dx;
+			if (a > b) { T t = a; a = b; b = t; }
+			if (a > enter) { enter = a; alongX = true; }
+			if (b < exit) exit = b;
+		}
+		else if (x < minX - r || x > maxX + r)
+			return none;
+		if (dz != zero) {
+			T a = (minZ - r - z) / dz, b = (maxZ + r - z) / dz;
+			if (a > b) { T t = a; a = b; b = t; }
+			if (a > enter) { enter = a; alongX = false; }
+			if (b < exit) exit = b;
+		}
+		else if (z < minZ - r || z > maxZ + r)
+			return none;
+		if (enter > exit || exit <= zero || enter > one)
+			return none;
+		if (enter < zero)
+			enter = zero;
+
+		T px = x + enter * dx, pz = z + enter * dz;
+		const bool corner = (px < minX || px > maxX) && (pz < minZ || pz > maxZ);
+		if (enter == zero && !corner) {
+			// on the face of the grown box without overlapping: a contact only if moving in
+			boxNormal(x, z, minX, maxX, minZ, maxZ, nx, nz);
+			return dx * nx + dz * nz < zero ? zero : none;
+		}
+		if (corner) {
+			// the corner region: the first contact, if any, is on the corner's circle
+			T kx = px < minX ? minX : maxX, kz = pz < minZ ? minZ : maxZ;
+			T mx = x - kx, mz = z - kz;
+			T t = circleTime(mx, mz, dx, dz, r);
+			if (t < zero)
+				return none;
+			T ox = mx + t * dx, oz = mz + t * dz, d = norm(ox, oz);
+			nx = d > zero ? ox / d : zero;
+			nz = d > zero ? oz / d : zero;
+			return t;
+		}
+		nx = alongX ? (dx > zero ? -one : one) : zero;
+		nz = alongX ? zero : (dz > zero ? -one : one);
+		return enter;
+	}
+
+	//
+	// All walls
+	//
+
+	// the boxes of the walls, by wall index
+	struct WallStore
+	{
+		AlignedArray<float> minX, maxX, minZ, maxZ;
+
+		void clear(void) { minX.clear(); maxX.clear(); minZ.clear(); maxZ.clear(); }
+		int size(void) const { return (int)minX.size(); }
+
+		// a wall centered at (x,z)
+		void add(float x, float z, float width, float depth)
+		{
+			minX.push_back(quantize(x - width / 2));
+			maxX.push_back(quantize(x + width / 2));
+			minZ.push_back(quantize(z - depth / 2));
+			maxZ.push_back(quantize(z + depth / 2));
+		}
+	};
+
+	// the earliest contact of a ball at (x,z) of radius r moving (dx,dz) with any wall:
+	// the wall's index, or -1 for none. t and (nx,nz) as for sweepBox; on a tie the lower
+	// index wins. the SIMD part only rules walls out, in float for either T, so every path
+	// finds the same contact.
+	template<class T>
+	inline int sweepWalls(const WallStore& walls, T x, T z, T dx, T dz, T r, T& t, T& nx, T& nz)
+	{
+		const int n = walls.size();
+		const float* minX = walls.minX.data();
+		const float* maxX = walls.maxX.data();
+		const float* minZ = walls.minZ.data();
+		const float* maxZ = walls.maxZ.data();
+		int best = -1;
+		t = T(2.0f);
+
+		int i = 0;
+#if defined(PHYS_SSE2)
+		{
+			// slabs of the grown boxes, with some slack so no contact is lost to rounding
+			const float SLACK = 1e-3f;
+			const float fdx = toFloat(dx), fdz = toFloat(dz);
+			const __m128 vx = _mm_set1_ps(toFloat(x)), vz = _mm_set1_ps(toFloat(z)), vr = _mm_set1_ps(toFloat(r));
+			const __m128 big = _mm_set1_ps(FLT_MAX), zero = _mm_setzero_ps();
+			// a move too small to divide by counts as none; it only decides at the boundary
+			const bool movesX = std::fabs(fdx) > 1e-20f, movesZ = std::fabs(fdz) > 1e-20f;
+			const __m128 invX = _mm_set1_ps(movesX ? 1.0f / fdx : 0.0f);
+			const __m128 invZ = _mm_set1_ps(movesZ ? 1.0f / fdz : 0.0f);
+			for (; i + 4 <= n; i += 4) {
+				__m128 lo = _mm_sub_ps(_mm_load_ps(minX + i), vr), hi = _mm_add_ps(_mm_load_ps(maxX + i), vr);
+				__m128 enterX, exitX, enterZ, exitZ;
+				if (movesX) {
+					__m128 a = _mm_mul_ps(_mm_sub_ps(lo, vx), invX), b = _mm_mul_ps(_mm_sub_ps(hi, vx), invX);
+					enterX = _mm_min_ps(a, b);
+					exitX = _mm_max_ps(a, b);
+				}
+				else {
+					__m128 in = _mm_and_ps(_mm_cmple_ps(lo, vx), _mm_cmpge_ps(hi, vx));
+					exitX = _mm_or_ps(_mm_and_ps(in, big), _mm_andnot_ps(in, _mm_sub_ps(zero, big)));
+					enterX = _mm_sub_ps(zero, exitX);
+				}
+				lo = _mm_sub_ps(_mm_load_ps(minZ + i), vr);
+				hi = _mm_add_ps(_mm_load_ps(maxZ + i), vr);
+				if (movesZ) {
+					__m128 a = _mm_mul_ps(_mm_sub_ps(lo, vz), invZ), b = _mm_mul_ps(_mm_sub_ps(hi, vz), invZ);
+					enterZ = _mm_min_ps(a, b);
+					exitZ = _mm_max_ps(a, b);
+				}
+				else {
+					__m128 in = _mm_and_ps(_mm_cmple_ps(lo, vz), _mm_cmpge_ps(hi, vz));
+					exitZ = _mm_or_ps(_mm_and_ps(in, big), _mm_andnot_ps(in, _mm_sub_ps(zero, big)));
+					enterZ = _mm_sub_ps(zero, exitZ);
+				}
+				__m128 enter = _mm_max_ps(enterX, enterZ), exit = _mm_min_ps(exitX, exitZ);
+				__m128 slack = _mm_set1_ps(SLACK);
+				__m128 maybe = _mm_and_ps(
+					_mm_and_ps(_mm_cmple_ps(enter, _mm_add_ps(exit, slack)), _mm_cmpge_ps(exit, _mm_sub_ps(zero, slack))),
+					_mm_cmple_ps(enter, _mm_set1_ps(toFloat(t) + SLACK)));
+				int mask = _mm_movemask_ps(maybe);
+				for (int lane = 0; mask; lane++, mask >>= 1) {
+					if (!(mask & 1))
+						continue;
+					const int w = i + lane;
+					T wx, wz;
+					T tw = sweepBox(x, z, dx, dz, r, T(minX[w]), T(maxX[w]), T(minZ[w]), T(maxZ[w]), wx, wz);
+					if (tw >= T(0.0f) && tw < t) {
+						t = tw; nx = wx; nz = wz; best = w;
+					}
+				}
+			}
+		}
+#endif
+		for (; i < n; i++) {
+			T wx, wz;
+			T tw = sweepBox(x, z, dx, dz, r, T(minX[i]), T(maxX[i]), T(minZ[i]), T(maxZ[i]), wx, wz);
+			if (tw >= T(0.0f) && tw < t) {
+				t = tw; nx = wx; nz = wz; best = i;
+			}
+		}
+		return best;
+	}
+
+	// push every moving ball (the rule of integrateBalls) that overlaps a wall out of it,
+	// reflecting its velocity, walls in index order. balls at rest are left alone, so
+	// bricks may touch the walls. the SIMD part only finds the balls to look at.
+	inline void collideWalls(const WallStore& walls, float* x, float* z, float* vx, float* vz,
+		const float* radius, int n)
+	{
+		const int numWalls = walls.size();
+		const float* minX = walls.minX.data();
+		const float* maxX = walls.maxX.data();
+		const float* minZ = walls.minZ.data();
+		const float* maxZ = walls.maxZ.data();
+		if (numWalls == 0)
+			return;
+
+		int i = 0;
+#if defined(PHYS_SSE2)
+		{
+			const __m128 eps  = _mm_set1_ps(0.01f);
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			for (; i + 4 <= n; i += 4) {
+				__m128 bvx = _mm_load_ps(vx + i);
+				__m128 bvz = _mm_load_ps(vz + i);
+				int moving = _mm_movemask_ps(_mm_or_ps(
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, bvx), eps),
+					_mm_cmpgt_ps(_mm_andnot_ps(sign, bvz), eps)));
+				if (!moving)
+					continue;
+				__m128 bx = _mm_load_ps(x + i), bz = _mm_load_ps(z + i), br = _mm_load_ps(radius + i);
+#if defined(PHYS_FIXED)
+				// pushOutOfBox decides in fixed point; some slack so the float test drops none
+				br = _mm_add_ps(br, _mm_set1_ps(1e-3f));
+#endif
+				__m128 r2 = _mm_mul_ps(br, br);
+				int touching = 0;
+				for (int w = 0; w < numWalls && touching != moving; w++) {
+					__m128 ox = _mm_sub_ps(bx, _mm_min_ps(_mm_max_ps(bx, _mm_set1_ps(minX[w])), _mm_set1_ps(maxX[w])));
+					__m128 oz = _mm_sub_ps(bz, _mm_min_ps(_mm_max_ps(bz, _mm_set1_ps(minZ[w])), _mm_set1_ps(maxZ[w])));
+					__m128 d2 = _mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oz, oz));
+					touching |= _mm_movemask_ps(_mm_cmplt_ps(d2, r2)) & moving;
+				}
+				for (int lane = 0; touching; lane++, touching >>= 1) {
+					if (!(touching & 1))
+						continue;
+					int j = i + lane;
+					for (int w = 0; w < numWalls; w++)
+						pushOutOfBox(x[j], z[j], vx[j], vz[j], radius[j], minX[w], maxX[w], minZ[w], maxZ[w]);
+				}
+			}
+		}
+#endif
+		for (; i < n; i++) {
+			if (std::fabs(vx[i]) > 0.01f || std::fabs(vz[i]) > 0.01f) {
+				for (int w = 0; w < numWalls; w++)
+					pushOutOfBox(x[i], z[i], vx[i], vz[i], radius[i], minX[w], maxX[w], minZ[w], maxZ[w]);
+			}
+		}
+	}
+}
+
+#endif // __legoWallsH__
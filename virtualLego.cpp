@@ -11,10 +11,18 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "d3dUtility.h"
+#include "legoInput.h"
+#include "legoLevel.h"
+#include "legoParticles.h"
+#include "legoPreview.h"
+#include "legoRender.h"
+#include "legoReplay.h"
+#include <string>
 #include <vector>
 #include <ctime>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #include <cmath>
 
@@ -24,22 +32,530 @@ IDirect3DDevice9* Device = NULL;
 const int Width  = 1024;
 const int Height = 768;
 
+// physics runs at a fixed rate; frames are drawn in between (0 = no frame cap)
+const float PhysicsRate  = 120.0f;
+const float MaxFrameRate = 0.0f;
+
 // -----------------------------------------------------------------------------
 // Transform matrices
 // -----------------------------------------------------------------------------
-D3DXMATRIX g_mWorld;
-D3DXMATRIX g_mView;
-D3DXMATRIX g_mProj;
+render::Matrix g_mWorld = render::identity();
+render::Matrix g_mView  = render::identity();
+render::Matrix g_mProj  = render::identity();
 
 #define M_RADIUS 0.21   // ball radius
 #define PI 3.14159265
 #define M_HEIGHT 0.01
 #define DECREASE_RATE 0.9982
 
-// initialize the position (coordinate) of each ball
-const float spherePos[6][2] = { {-2.0f,3.0f} , {-0.7f,2.5f} , {2.0f,2.5f} , {0.7f,3.0f},{.0f,-5.0f+0.1f+M_RADIUS},{.0f,-5.0f+0.11f+3*M_RADIUS}}; 
-// initialize the color of each ball
-const D3DXCOLOR sphereColor[6] = {d3d::YELLOW, d3d::YELLOW, d3d::YELLOW, d3d::YELLOW,d3d::BLUE,d3d::MAGENTA};
+// color of each kind of ball: brick, paddle, shot, marker (see phys::BallKind)
+const D3DXCOLOR sphereColor[4] = {d3d::YELLOW, d3d::BLUE, d3d::MAGENTA, d3d::WHITE};
+
+
+// -----------------------------------------------------------------------------
+// CSphereBatch class definition
+// -----------------------------------------------------------------------------
+
+// every ball is drawn from one shared sphere mesh. with shader model 3 all of them
+// go out in a single instanced draw: stream 0 is the mesh, stream 1 holds the
+// position, scale and color of each ball. the vertex shader does the per-vertex
+// lighting of the fixed-function pipeline for the point light of Setup().
+// older hardware falls back to one DrawSubset of the shared mesh per ball.
+// the mesh comes in a few levels of detail, picked per ball from its radius on screen
+// (see render::sphereLod).
+
+const int NumSphereLods = render::NUM_SPHERE_LODS;
+
+struct SphereInstance
+{
+	float		x, y, z;
+	float		scale;		// radius / M_RADIUS
+	D3DCOLOR	color;
+};
+
+const char* SphereVertexShader =
+	"float4x4 worldViewProj : register(c0);\n"
+	"float4x4 world         : register(c4);\n"
+	"float4   lightPos      : register(c8);\n"
+	"float4   lightDiffuse  : register(c9);\n"
+	"float4   lightAmbient  : register(c10);\n"
+	"float4   lightSpecular : register(c11);\n"
+	"float4   lightAtten    : register(c12);   // attenuation 0, 1, 2 and range\n"
+	"float4   eyePos        : register(c13);\n"
+	"float4   mtrlPower     : register(c14);\n"
+	"struct VS_OUT { float4 pos : POSITION; float4 diffuse : COLOR0; float4 specular : COLOR1; };\n"
+	"VS_OUT main(float3 pos : POSITION, float3 normal : NORMAL, float4 inst : TEXCOORD0, float4 color : COLOR0)\n"
+	"{\n"
+	"    float4 local = float4(pos * inst.w + inst.xyz, 1.0f);\n"
+	"    float3 p = mul(local, world).xyz;\n"
+	"    float3 n = normalize(mul(normal, (float3x3)world));\n"
+	"    float3 toLight = lightPos.xyz - p;\n"
+	"    float  d = length(toLight);\n"
+	"    float3 l = toLight / d;\n"
+	"    float  atten = d <= lightAtten.w ? 1.0f / dot(lightAtten.xyz, float3(1.0f, d, d * d)) : 0.0f;\n"
+	"    float3 h = normalize(normalize(eyePos.xyz - p) + l);\n"
+	"    VS_OUT o;\n"
+	"    o.pos = mul(local, worldViewProj);\n"
+	"    o.diffuse  = saturate(float4(color.rgb * (lightAmbient.rgb + lightDiffuse.rgb * max(dot(n, l), 0.0f)) * atten, color.a));\n"
+	"    o.specular = saturate(float4(color.rgb * lightSpecular.rgb * pow(max(dot(n, h), 0.0f), mtrlPower.x) * atten, 0.0f));\n"
+	"    return o;\n"
+	"}\n";
+
+const char* SpherePixelShader =
+	"float4 main(float4 diffuse : COLOR0, float4 specular : COLOR1) : COLOR\n"
+	"{\n"
+	"    return saturate(float4(diffuse.rgb + specular.rgb, diffuse.a));\n"
+	"}\n";
+
+class CSphereBatch {
+public:
+	CSphereBatch(void) : m_radius((float)M_RADIUS)
+	{
+		for (int i = 0; i < NumSphereLods; i++)
+			m_pMesh[i] = NULL;
+		m_pInstanceVB = NULL;
+		m_pDecl = NULL;
+		m_pVS = NULL;
+		m_pPS = NULL;
+		m_capacity = 0;
+	}
+	~CSphereBatch(void) {}
+
+public:
+	bool create(IDirect3DDevice9* pDevice, float radius)
+	{
+		if (NULL == pDevice)
+			return false;
+		for (int i = 0; i < NumSphereLods; i++) {
+			if (FAILED(D3DXCreateSphere(pDevice, radius, render::SPHERE_LOD_SLICES[i], render::SPHERE_LOD_SLICES[i], &m_pMesh[i], NULL)))
+				return false;
+		}
+		m_radius = radius;
+
+		// instancing is optional; without it the shared mesh is drawn per ball
+		D3DCAPS9 caps;
+		pDevice->GetDeviceCaps(&caps);
+		if (caps.VertexShaderVersion >= D3DVS_VERSION(3, 0) && caps.PixelShaderVersion >= D3DPS_VERSION(3, 0)) {
+			if (!createInstancing(pDevice))
+				destroyInstancing();
+		}
+		return true;
+	}
+
+	void destroy(void)
+	{
+		destroyInstancing();
+		for (int i = 0; i < NumSphereLods; i++) {
+			d3d::Release<ID3DXMesh*>(m_pMesh[i]);
+			m_pMesh[i] = NULL;
+		}
+	}
+
+	// collect the balls of one frame, then draw them with draw()
+	void begin(void) { m_instances.clear(); }
+
+	void add(float x, float y, float z, float radius, const D3DXCOLOR& color)
+	{
+		SphereInstance inst = { x, y, z, radius / m_radius, (D3DCOLOR)color };
+		m_instances.push_back(inst);
+	}
+
+	// viewHeight is the height of the viewport in pixels
+	void draw(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld, const D3DXMATRIX& mView,
+		const D3DXMATRIX& mProj, const D3DLIGHT9& light, float viewHeight)
+	{
+		if (NULL == pDevice || m_instances.empty())
+			return;
+		sortByLod(mWorld * mView, mProj._22 * viewHeight / 2);
+		if (m_pVS && fillInstances(pDevice))
+			drawInstanced(pDevice, mWorld, mView, mProj, light);
+		else
+			drawEach(pDevice, mWorld);
+	}
+
+private:
+	// order the instances by level of detail into m_sorted. pixels is the size on
+	// screen of one unit at distance one.
+	void sortByLod(const D3DXMATRIX& mWorldView, float pixels)
+	{
+		const size_t n = m_instances.size();
+		m_lods.resize(n);
+		int count[NumSphereLods] = { 0 };
+		for (size_t i = 0; i < n; i++) {
+			const SphereInstance& inst = m_instances[i];
+			float z = inst.x * mWorldView._13 + inst.y * mWorldView._23 + inst.z * mWorldView._33 + mWorldView._43;
+			int lod = render::sphereLod(z > 0.0f ? inst.scale * m_radius * pixels / z : FLT_MAX);
+			m_lods[i] = lod;
+			count[lod]++;
+		}
+
+		m_sorted.resize(n);
+		int next[NumSphereLods];
+		for (int l = 0, start = 0; l < NumSphereLods; l++) {
+			m_lodStart[l] = next[l] = start;
+			m_lodCount[l] = count[l];
+			start += count[l];
+		}
+		for (size_t i = 0; i < n; i++)
+			m_sorted[next[m_lods[i]]++] = m_instances[i];
+	}
+
+	bool createInstancing(IDirect3DDevice9* pDevice)
+	{
+		const D3DVERTEXELEMENT9 decl[] = {
+			{ 0, 0,  D3DDECLTYPE_FLOAT3,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+			{ 0, 12, D3DDECLTYPE_FLOAT3,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL,   0 },
+			{ 1, 0,  D3DDECLTYPE_FLOAT4,   D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+			{ 1, 16, D3DDECLTYPE_D3DCOLOR, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_COLOR,    0 },
+			D3DDECL_END()
+		};
+		if (FAILED(pDevice->CreateVertexDeclaration(decl, &m_pDecl)))
+			return false;
+
+		ID3DXBuffer* code = NULL;
+		bool ok = SUCCEEDED(D3DXCompileShader(SphereVertexShader, (UINT)strlen(SphereVertexShader),
+			NULL, NULL, "main", "vs_3_0", 0, &code, NULL, NULL))
+			&& SUCCEEDED(pDevice->CreateVertexShader((const DWORD*)code->GetBufferPointer(), &m_pVS));
+		d3d::Release<ID3DXBuffer*>(code);
+		code = NULL;
+		ok = ok && SUCCEEDED(D3DXCompileShader(SpherePixelShader, (UINT)strlen(SpherePixelShader),
+			NULL, NULL, "main", "ps_3_0", 0, &code, NULL, NULL))
+			&& SUCCEEDED(pDevice->CreatePixelShader((const DWORD*)code->GetBufferPointer(), &m_pPS));
+		d3d::Release<ID3DXBuffer*>(code);
+		return ok;
+	}
+
+	void destroyInstancing(void)
+	{
+		d3d::Release<IDirect3DVertexBuffer9*>(m_pInstanceVB);
+		d3d::Release<IDirect3DVertexDeclaration9*>(m_pDecl);
+		d3d::Release<IDirect3DVertexShader9*>(m_pVS);
+		d3d::Release<IDirect3DPixelShader9*>(m_pPS);
+		m_pInstanceVB = NULL;
+		m_pDecl = NULL;
+		m_pVS = NULL;
+		m_pPS = NULL;
+		m_capacity = 0;
+	}
+
+	// copy this frame's instances into the dynamic buffer, growing it as needed
+	bool fillInstances(IDirect3DDevice9* pDevice)
+	{
+		UINT n = (UINT)m_sorted.size();
+		if (n > m_capacity) {
+			UINT capacity = m_capacity ? m_capacity : 64;
+			while (capacity < n) capacity *= 2;
+			d3d::Release<IDirect3DVertexBuffer9*>(m_pInstanceVB);
+			m_pInstanceVB = NULL;
+			m_capacity = 0;
+			if (FAILED(pDevice->CreateVertexBuffer(capacity * sizeof(SphereInstance),
+				D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &m_pInstanceVB, NULL)))
+				return false;
+			m_capacity = capacity;
+		}
+
+		void* p = NULL;
+		if (FAILED(m_pInstanceVB->Lock(0, n * sizeof(SphereInstance), &p, D3DLOCK_DISCARD)))
+			return false;
+		memcpy(p, &m_sorted[0], n * sizeof(SphereInstance));
+		m_pInstanceVB->Unlock();
+		return true;
+	}
+
+	void drawInstanced(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld, const D3DXMATRIX& mView,
+		const D3DXMATRIX& mProj, const D3DLIGHT9& light)
+	{
+		// shader constants are column major, so matrices go in transposed
+		D3DXMATRIX m, wvp = mWorld * mView * mProj;
+		D3DXMatrixTranspose(&m, &wvp);
+		pDevice->SetVertexShaderConstantF(0, m, 4);
+		D3DXMatrixTranspose(&m, &mWorld);
+		pDevice->SetVertexShaderConstantF(4, m, 4);
+
+		D3DXMATRIX viewInv;
+		D3DXMatrixInverse(&viewInv, NULL, &mView);
+		const float c[7][4] = {
+			{ light.Position.x, light.Position.y, light.Position.z, 1.0f },
+			{ light.Diffuse.r,  light.Diffuse.g,  light.Diffuse.b,  light.Diffuse.a },
+			{ light.Ambient.r,  light.Ambient.g,  light.Ambient.b,  light.Ambient.a },
+			{ light.Specular.r, light.Specular.g, light.Specular.b, light.Specular.a },
+			{ light.Attenuation0, light.Attenuation1, light.Attenuation2, light.Range },
+			{ viewInv._41, viewInv._42, viewInv._43, 1.0f },
+			{ 5.0f, 0.0f, 0.0f, 0.0f },		// material power, as CWall uses
+		};
+		pDevice->SetVertexShaderConstantF(8, &c[0][0], 7);
+
+		pDevice->SetVertexDeclaration(m_pDecl);
+		pDevice->SetVertexShader(m_pVS);
+		pDevice->SetPixelShader(m_pPS);
+		pDevice->SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+
+		// one instanced draw per level of detail in use
+		for (int l = 0; l < NumSphereLods; l++) {
+			if (m_lodCount[l] == 0)
+				continue;
+			ID3DXMesh* mesh = m_pMesh[l];
+			IDirect3DVertexBuffer9* vb = NULL;
+			IDirect3DIndexBuffer9* ib = NULL;
+			mesh->GetVertexBuffer(&vb);
+			mesh->GetIndexBuffer(&ib);
+			pDevice->SetStreamSource(0, vb, 0, mesh->GetNumBytesPerVertex());
+			pDevice->SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | (UINT)m_lodCount[l]);
+			pDevice->SetStreamSource(1, m_pInstanceVB, m_lodStart[l] * sizeof(SphereInstance), sizeof(SphereInstance));
+			pDevice->SetIndices(ib);
+			pDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, mesh->GetNumVertices(), 0, mesh->GetNumFaces());
+			d3d::Release<IDirect3DVertexBuffer9*>(vb);
+			d3d::Release<IDirect3DIndexBuffer9*>(ib);
+		}
+
+		// back to the fixed-function state the other objects are drawn with
+		pDevice->SetStreamSourceFreq(0, 1);
+		pDevice->SetStreamSourceFreq(1, 1);
+		pDevice->SetStreamSource(1, NULL, 0, 0);
+		pDevice->SetVertexShader(NULL);
+		pDevice->SetPixelShader(NULL);
+	}
+
+	void drawEach(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld)
+	{
+		D3DXMATRIX mLocal;
+		D3DMATERIAL9 mtrl;
+		for (int l = 0; l < NumSphereLods; l++) {
+			for (int i = m_lodStart[l]; i < m_lodStart[l] + m_lodCount[l]; i++) {
+				const SphereInstance& inst = m_sorted[i];
+				D3DXCOLOR color(inst.color);
+				mtrl = d3d::InitMtrl(color, color, color, d3d::BLACK, 5.0f);
+				D3DXMatrixScaling(&mLocal, inst.scale, inst.scale, inst.scale);
+				mLocal._41 = inst.x; mLocal._42 = inst.y; mLocal._43 = inst.z;
+				pDevice->SetTransform(D3DTS_WORLD, &mWorld);
+				pDevice->MultiplyTransform(D3DTS_WORLD, &mLocal);
+				pDevice->SetMaterial(&mtrl);
+				m_pMesh[l]->DrawSubset(0);
+			}
+		}
+	}
+
+	ID3DXMesh*						m_pMesh[NumSphereLods];
+	float							m_radius;
+	std::vector<SphereInstance>		m_instances;
+	std::vector<SphereInstance>		m_sorted;		// m_instances by level of detail
+	std::vector<int>				m_lods;
+	int								m_lodStart[NumSphereLods];
+	int								m_lodCount[NumSphereLods];
+	IDirect3DVertexBuffer9*			m_pInstanceVB;
+	UINT							m_capacity;		// instances m_pInstanceVB can hold
+	IDirect3DVertexDeclaration9*	m_pDecl;
+	IDirect3DVertexShader9*			m_pVS;
+	IDirect3DPixelShader9*			m_pPS;
+};
+
+
+// -----------------------------------------------------------------------------
+// D3DRenderer class definition
+// -----------------------------------------------------------------------------
+
+// the Direct3D backend of render::Renderer (see legoRender.h; legoRaster.h draws the
+// same on the CPU). boxes are D3DX meshes, spheres go through CSphereBatch, particles
+// are point sprites in one DrawPrimitiveUP.
+
+struct ParticleVertex
+{
+	float		x, y, z;
+	D3DCOLOR	color;
+};
+
+inline DWORD floatBits(float f)
+{
+	DWORD d;
+	memcpy(&d, &f, sizeof(d));
+	return d;
+}
+
+inline D3DXMATRIX toD3DX(const render::Matrix& m)
+{
+	D3DXMATRIX r;
+	memcpy(r.m, m.m, sizeof(r.m));
+	return r;
+}
+
+inline render::Color toColor(const D3DXCOLOR& c) { return render::color(c.r, c.g, c.b, c.a); }
+
+inline D3DCOLORVALUE toD3D(const render::Color& c)
+{
+	D3DCOLORVALUE r = { c.r, c.g, c.b, c.a };
+	return r;
+}
+
+class D3DRenderer : public render::Renderer {
+public:
+	D3DRenderer(void)
+	{
+		m_pDevice = NULL;
+		m_viewHeight = 0.0f;
+		m_particleSize = 0.0f;
+		D3DXMatrixIdentity(&m_mView);
+		D3DXMatrixIdentity(&m_mProj);
+		::ZeroMemory(&m_lit, sizeof(m_lit));
+	}
+	~D3DRenderer(void) {}
+
+public:
+	bool create(IDirect3DDevice9* pDevice, int viewHeight)
+	{
+		if (NULL == pDevice)
+			return false;
+		m_pDevice = pDevice;
+		m_viewHeight = (float)viewHeight;
+		return m_spheres.create(pDevice, (float)M_RADIUS);
+	}
+
+	void destroy(void)
+	{
+		destroyMeshes();
+		m_spheres.destroy();
+		m_pDevice = NULL;
+	}
+
+	IDirect3DDevice9* device(void) const { return m_pDevice; }
+
+	// a level has few sizes of box, so a box of a size made before shares its mesh
+	int createBox(float width, float height, float depth)
+	{
+		for (size_t i = 0; i < m_boxSizes.size(); i++) {
+			const render::Vec3& size = m_boxSizes[i];
+			if (size.x == width && size.y == height && size.z == depth)
+				return (int)i;
+		}
+		ID3DXMesh* mesh = NULL;
+		if (NULL == m_pDevice || FAILED(D3DXCreateBox(m_pDevice, width, height, depth, &mesh, NULL)))
+			return -1;
+		m_boxes.push_back(m_levelResources.add(mesh));
+		m_boxSizes.push_back(render::vec3(width, height, depth));
+		return (int)m_boxes.size() - 1;
+	}
+
+	void destroyMeshes(void)
+	{
+		m_levelResources.releaseAll();
+		m_boxes.clear();
+		m_boxSizes.clear();
+	}
+
+	void setCamera(const render::Matrix& view, const render::Matrix& proj)
+	{
+		m_mView = toD3DX(view);
+		m_mProj = toD3DX(proj);
+		m_pDevice->SetTransform(D3DTS_VIEW, &m_mView);
+		m_pDevice->SetTransform(D3DTS_PROJECTION, &m_mProj);
+	}
+
+	void setLight(const render::Light& light)
+	{
+		::ZeroMemory(&m_lit, sizeof(m_lit));
+		m_lit.Type         = D3DLIGHT_POINT;
+		m_lit.Diffuse      = toD3D(light.diffuse);
+		m_lit.Specular     = toD3D(light.specular);
+		m_lit.Ambient      = toD3D(light.ambient);
+		m_lit.Position     = D3DXVECTOR3(light.position.x, light.position.y, light.position.z);
+		m_lit.Range        = light.range;
+		m_lit.Attenuation0 = light.attenuation0;
+		m_lit.Attenuation1 = light.attenuation1;
+		m_lit.Attenuation2 = light.attenuation2;
+		m_pDevice->SetLight(0, &m_lit);
+		m_pDevice->LightEnable(0, TRUE);
+	}
+
+	void beginFrame(unsigned int clearRGB)
+	{
+		m_pDevice->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, clearRGB, 1.0f, 0);
+		m_pDevice->BeginScene();
+		m_spheres.begin();
+		m_particles.clear();
+	}
+
+	void drawBox(int box, const render::Matrix& world, const render::Material& mtrl)
+	{
+		if (box < 0 || box >= (int)m_boxes.size())
+			return;
+		D3DXMATRIX m = toD3DX(world);
+		D3DMATERIAL9 d3dMtrl;
+		d3dMtrl.Ambient  = toD3D(mtrl.ambient);
+		d3dMtrl.Diffuse  = toD3D(mtrl.diffuse);
+		d3dMtrl.Specular = toD3D(mtrl.specular);
+		d3dMtrl.Emissive = toD3D(mtrl.emissive);
+		d3dMtrl.Power    = mtrl.power;
+		m_pDevice->SetTransform(D3DTS_WORLD, &m);
+		m_pDevice->SetMaterial(&d3dMtrl);
+		m_boxes[box]->DrawSubset(0);
+	}
+
+	void drawSphere(const render::Vec3& center, float radius, const render::Material& mtrl)
+	{
+		const render::Color& c = mtrl.diffuse;
+		m_spheres.add(center.x, center.y, center.z, radius, D3DXCOLOR(c.r, c.g, c.b, c.a));
+	}
+
+	// the vertices are kept for reuse, so a steady stream of debris does not allocate
+	void drawParticles(const float* x, const float* y, const float* z, const unsigned int* rgb, int n, float size)
+	{
+		m_particles.resize(n);
+		for (int i = 0; i < n; i++) {
+			ParticleVertex& v = m_particles[i];
+			v.x = x[i]; v.y = y[i]; v.z = z[i];
+			v.color = D3DCOLOR_XRGB((rgb[i] >> 16) & 0xff, (rgb[i] >> 8) & 0xff, rgb[i] & 0xff);
+		}
+		m_particleSize = size;
+	}
+
+	void endFrame(void)
+	{
+		D3DXMATRIX mWorld;
+		D3DXMatrixIdentity(&mWorld);
+		m_spheres.draw(m_pDevice, mWorld, m_mView, m_mProj, m_lit, m_viewHeight);
+		drawParticleSprites(mWorld);
+		m_pDevice->EndScene();
+	}
+
+	void present(void)
+	{
+		m_pDevice->Present(0, 0, 0, 0);
+		m_pDevice->SetTexture(0, NULL);
+	}
+
+private:
+	// unlit squares of m_particleSize world units: the point size shrinks as 1 / distance
+	void drawParticleSprites(const D3DXMATRIX& mWorld)
+	{
+		if (m_particles.empty())
+			return;
+		m_pDevice->SetTransform(D3DTS_WORLD, &mWorld);
+		m_pDevice->SetRenderState(D3DRS_LIGHTING, FALSE);
+		m_pDevice->SetRenderState(D3DRS_POINTSPRITEENABLE, TRUE);
+		m_pDevice->SetRenderState(D3DRS_POINTSCALEENABLE, TRUE);
+		m_pDevice->SetRenderState(D3DRS_POINTSIZE, floatBits(m_particleSize * m_mProj._22 / 2));
+		m_pDevice->SetRenderState(D3DRS_POINTSIZE_MIN, floatBits(1.0f));
+		m_pDevice->SetRenderState(D3DRS_POINTSCALE_A, floatBits(0.0f));
+		m_pDevice->SetRenderState(D3DRS_POINTSCALE_B, floatBits(0.0f));
+		m_pDevice->SetRenderState(D3DRS_POINTSCALE_C, floatBits(1.0f));
+		m_pDevice->SetFVF(D3DFVF_XYZ | D3DFVF_DIFFUSE);
+		m_pDevice->DrawPrimitiveUP(D3DPT_POINTLIST, (UINT)m_particles.size(), &m_particles[0], sizeof(ParticleVertex));
+		m_pDevice->SetRenderState(D3DRS_POINTSCALEENABLE, FALSE);
+		m_pDevice->SetRenderState(D3DRS_POINTSPRITEENABLE, FALSE);
+		m_pDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
+	}
+
+	IDirect3DDevice9*		m_pDevice;
+	float					m_viewHeight;
+	D3DXMATRIX				m_mView;
+	D3DXMATRIX				m_mProj;
+	D3DLIGHT9				m_lit;
+	std::vector<ID3DXMesh*>	m_boxes;
+	std::vector<render::Vec3>	m_boxSizes;	// width, height, depth of each of m_boxes
+	d3d::ResourceRegistry	m_levelResources;	// owns m_boxes
+	std::vector<ParticleVertex>	m_particles;	// of this frame
+	float					m_particleSize;
+	CSphereBatch			m_spheres;
+};
 
 
 // -----------------------------------------------------------------------------
@@ -48,137 +564,132 @@ const D3DXCOLOR sphereColor[6] = {d3d::YELLOW, d3d::YELLOW, d3d::YELLOW, d3d::YE
 
 class CSphere {
 private :
-	float center_x, center_y, center_z;
-    float m_radius;
-	float m_velocity_x;
-	float m_velocity_z;
+	phys::World*	m_world;	// simulation state lives in the physics core
+	int				m_id;
 
 public:
     CSphere(void)
     {
-        D3DXMatrixIdentity(&m_mLocal);
-        ZeroMemory(&m_mtrl, sizeof(m_mtrl));
-        m_radius = M_RADIUS;
-		m_velocity_x = 0;
-		m_velocity_z = 0;
-        m_pSphereMesh = NULL;
+        m_mLocal = render::identity();
+        m_mtrl = render::material(render::color(1, 1, 1));
+		m_world = NULL;
+		m_id = -1;
+		m_box = -1;
     }
     ~CSphere(void) {}
 
 public:
-    bool create(IDirect3DDevice9* pDevice, D3DXCOLOR color = d3d::WHITE)
+    bool create(D3DXCOLOR color = d3d::WHITE)
     {
-        if (NULL == pDevice)
-            return false;
-		
-        m_mtrl.Ambient  = color;
-        m_mtrl.Diffuse  = color;
-        m_mtrl.Specular = color;
-        m_mtrl.Emissive = d3d::BLACK;
-        m_mtrl.Power    = 5.0f;
-		
-        if (FAILED(D3DXCreateSphere(pDevice, getRadius(), 50, 50, &m_pSphereMesh, NULL)))
-            return false;
+        m_mtrl = render::material(toColor(color), 5.0f);
         return true;
     }
-	
-    void destroy(void)
-    {
-        if (m_pSphereMesh != NULL) {
-            m_pSphereMesh->Release();
-            m_pSphereMesh = NULL;
-        }
-    }
 
-    void draw(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld)
+	// a brick is drawn as a box of its own size instead of the shared sphere; the
+	// renderer makes one mesh per size and owns it. width 0 draws a sphere again.
+	bool setBox(render::Renderer& renderer, float width, float depth)
+	{
+		if (width <= 0.0f) {
+			m_box = -1;
+			return true;
+		}
+		if (m_box < 0 || width != m_boxWidth || depth != m_boxDepth) {
+			m_box = renderer.createBox(width, phys::BRICK_HEIGHT, depth);
+			m_boxWidth = width;
+			m_boxDepth = depth;
+		}
+		return m_box >= 0;
+	}
+
+	// attach this sphere to ball 'id' of the world
+	void bind(phys::World* world, int id)
+	{
+		m_world = world;
+		m_id = id;
+	}
+	
+	// the renderer may batch the balls; the mesh is shared by all of them.
+	// alpha blends between the last two physics steps (see d3d::EnterMsgLoop).
+	// removed balls and balls outside the frustum are skipped; returns whether it was drawn
+    bool draw(render::Renderer& renderer, const render::Matrix& mWorld, const d3d::Frustum& frustum, float alpha = 1.0f)
     {
-        if (NULL == pDevice)
-            return;
-        pDevice->SetTransform(D3DTS_WORLD, &mWorld);
-        pDevice->MultiplyTransform(D3DTS_WORLD, &m_mLocal);
-        pDevice->SetMaterial(&m_mtrl);
-		m_pSphereMesh->DrawSubset(0);
+		if (NULL == m_world || !m_world->isAlive(m_id))
+			return false;
+		phys::Ball b = m_world->ballAt(m_id, alpha);
+		m_mLocal = render::translation(b.x, b.y, b.z);
+
+		d3d::BoundingSphere bound;
+		bound._center = render::transformCoord(render::vec3(b.x, b.y, b.z), mWorld);
+		bound._radius = b.radius;
+		if (m_box >= 0)
+			bound._radius = std::sqrt(b.radius * b.radius + phys::BRICK_HEIGHT * phys::BRICK_HEIGHT / 4);
+		if (!frustum.isVisible(bound))
+			return false;
+
+		if (m_box >= 0) {
+			renderer.drawBox(m_box, m_mLocal * mWorld, m_mtrl);
+			return true;
+		}
+		renderer.drawSphere(bound._center, b.radius, m_mtrl);
+		return true;
     }
 	
 	bool hasIntersected(CSphere& ball)
 	{
-		// Insert your code here.
-		float Distanceball = (float)(pow((center_x - ball.center_x), 2) + pow((center_z - ball.center_z), 2)); //두 공 사이의 거리
-		if (Distanceball < (M_RADIUS*2)*(M_RADIUS*2)) return true; //충돌시 중심 거리의 반이 반지름이므로 
-		return false;
+		return phys::hasIntersected(state(), ball.state());
 	}
 
 	void hitBy(CSphere& ball) 
 	{   
-		if (hasIntersected(ball)){//속도 고정하면서 방향 변하게 설정
-
-		    float dx =(ball.getCenter().x - center_x);
-		    float dz = (ball.getCenter().z - center_z);
-		    float Adjustment_constant;
-
-		    float size_V = sqrt(ball.getVelocity_X() * ball.getVelocity_X() + ball.getVelocity_Z() * ball.getVelocity_Z());
-		    float size_D = sqrt(dx * dx + dz * dz);
-            Adjustment_constant = size_V / size_D;
-
-		    float new_V_x = Adjustment_constant * dx;
-		    float new_V_z = Adjustment_constant * dz;
-
-		    ball.setPower(new_V_x, new_V_z);
-        }    
+		phys::Ball b = ball.state();
+		phys::hitBy(state(), b);
+		ball.setState(b);
     }
 
 	void ballUpdate(float timeDiff) 
 	{
-		const float TIME_SCALE = 3.3;
-		D3DXVECTOR3 cord = this->getCenter();
-		double vx = abs(this->getVelocity_X());
-		double vz = abs(this->getVelocity_Z());
-
-		if(vx > 0.01 || vz > 0.01)
-		{
-			float tX = cord.x + TIME_SCALE*timeDiff*m_velocity_x;
-			float tZ = cord.z + TIME_SCALE*timeDiff*m_velocity_z;
-
-			
-			this->setCenter(tX, cord.y, tZ);
-		}
+		phys::Ball b = state();
+		phys::ballUpdate(b, timeDiff);
+		setState(b);
 	}
 
-	double getVelocity_X() { return this->m_velocity_x;	}
-	double getVelocity_Z() { return this->m_velocity_z; }
+	double getVelocity_X() { return state().vx; }
+	double getVelocity_Z() { return state().vz; }
 
 	void setPower(double vx, double vz)
 	{
-		this->m_velocity_x = vx;
-		this->m_velocity_z = vz;
+		m_world->setVelocity(m_id, (float)vx, (float)vz);
 	}
 
 	void setCenter(float x, float y, float z)
 	{
-		D3DXMATRIX m;
-		center_x=x;	center_y=y;	center_z=z;
-		D3DXMatrixTranslation(&m, x, y, z);
-		setLocalTransform(m);
+		m_world->setCenter(m_id, x, y, z);
+		m_mLocal = render::translation(x, y, z);
 	}
 	
 	float getRadius(void)  const { return (float)(M_RADIUS);  }
-    const D3DXMATRIX& getLocalTransform(void) const { return m_mLocal; }
-    void setLocalTransform(const D3DXMATRIX& mLocal) { m_mLocal = mLocal; }
-    D3DXVECTOR3 getCenter(void) const
+    const render::Matrix& getLocalTransform(void) const { return m_mLocal; }
+    void setLocalTransform(const render::Matrix& mLocal) { m_mLocal = mLocal; }
+    render::Vec3 getCenter(void) const
     {
-        D3DXVECTOR3 org(center_x, center_y, center_z);
-        return org;
+		phys::Ball b = state();
+        return render::vec3(b.x, b.y, b.z);
     }
 
     void setRadius(float radius){
-		this->m_radius=radius;
+		phys::Ball b = state();
+		b.radius = radius;
+		setState(b);
 	}
+
+	phys::Ball state(void) const { return m_world->ball(m_id); }
+	void setState(const phys::Ball& b) { m_world->setBall(m_id, b); }
 	
 private:
-    D3DXMATRIX              m_mLocal;
-    D3DMATERIAL9            m_mtrl;
-    ID3DXMesh*              m_pSphereMesh;
-	
+    render::Matrix          m_mLocal;
+    render::Material        m_mtrl;
+	int						m_box;			// brick mesh, -1 for a ball
+	float					m_boxWidth, m_boxDepth;
 };
 
 
@@ -200,112 +711,99 @@ private:
 public:
     CWall(void)
     {
-        D3DXMatrixIdentity(&m_mLocal);
-        ZeroMemory(&m_mtrl, sizeof(m_mtrl));
+        m_mLocal = render::identity();
+        m_mtrl = render::material(render::color(1, 1, 1));
+        m_x = 0;
+        m_z = 0;
         m_width = 0;
         m_depth = 0;
-        m_pBoundMesh = NULL;
+        m_height = 0;
+        m_box = -1;
     }
     ~CWall(void) {}
 public:
-    bool create(IDirect3DDevice9* pDevice, float ix, float iz, float iwidth, float iheight, float idepth, D3DXCOLOR color = d3d::WHITE)
+    bool create(render::Renderer& renderer, float ix, float iz, float iwidth, float iheight, float idepth, D3DXCOLOR color = d3d::WHITE)
     {
-        if (NULL == pDevice)
-            return false;
-		
-        m_mtrl.Ambient  = color;
-        m_mtrl.Diffuse  = color;
-        m_mtrl.Specular = color;
-        m_mtrl.Emissive = d3d::BLACK;
-        m_mtrl.Power    = 5.0f;
+        m_mtrl = render::material(toColor(color), 5.0f);
 		
         m_width = iwidth;
         m_depth = idepth;
+        m_height = iheight;
 		
-        if (FAILED(D3DXCreateBox(pDevice, iwidth, iheight, idepth, &m_pBoundMesh, NULL)))
-            return false;
-        return true;
+        m_box = renderer.createBox(iwidth, iheight, idepth);
+        return m_box >= 0;
     }
+	// the box mesh belongs to the renderer (see render::Renderer::destroyMeshes)
     void destroy(void)
     {
-        if (m_pBoundMesh != NULL) {
-            m_pBoundMesh->Release();
-            m_pBoundMesh = NULL;
-        }
+        m_box = -1;
     }
-    void draw(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld)
+	// skipped if the box is outside the frustum; returns whether it was drawn
+    bool draw(render::Renderer& renderer, const render::Matrix& mWorld, const d3d::Frustum& frustum)
     {
-        if (NULL == pDevice)
-            return;
-        pDevice->SetTransform(D3DTS_WORLD, &mWorld);
-        pDevice->MultiplyTransform(D3DTS_WORLD, &m_mLocal);
-        pDevice->SetMaterial(&m_mtrl);
-		m_pBoundMesh->DrawSubset(0);
+		render::Matrix m = m_mLocal * mWorld;
+		if (!frustum.isVisible(getBound(m)))
+			return false;
+        renderer.drawBox(m_box, m, m_mtrl);
+		return true;
     }
 
+	// world space bounds of the box under m
+	d3d::BoundingBox getBound(const render::Matrix& m) const
+	{
+		d3d::BoundingBox box;
+		for (int i = 0; i < 8; i++) {
+			render::Vec3 p = render::transformCoord(render::vec3((i & 1 ? 0.5f : -0.5f) * m_width,
+				(i & 2 ? 0.5f : -0.5f) * m_height, (i & 4 ? 0.5f : -0.5f) * m_depth), m);
+			box._min = render::minimize(box._min, p);
+			box._max = render::maximize(box._max, p);
+		}
+		return box;
+	}
+
 	
 	bool hasIntersected(CSphere& ball) 
 	{
-		// Insert your code here.
-        //긴 바
-        if (ball.getCenter().x >= (3 - M_RADIUS))  return true;
-        if (ball.getCenter().x <= (-3 + M_RADIUS)) return true;
-        //짧은 바
-        if (ball.getCenter().z <= (-5 + M_RADIUS))	 return true;
-        if (ball.getCenter().z >= (5 - M_RADIUS))	 return true;
-		return false;
+		return phys::hasIntersected(state(), ball.state());
 	}
 
 	void hitBy(CSphere& ball) 
 	{
-		// Insert your code here.
-        //벽에 충돌 시 속도변화 고려
-
-    if(hasIntersected(ball)){
-        //긴 바
-        if (ball.getCenter()[0] >= (3 - M_RADIUS)) {
-            ball.setCenter((3 - M_RADIUS),ball.getCenter().y,ball.getCenter().z);
-            ball.setPower(-ball.getVelocity_X(),ball.getVelocity_Z());
-        }
-        if (ball.getCenter()[0] <= (-3 + M_RADIUS)){
-            ball.setCenter((-3 + M_RADIUS),ball.getCenter().y,ball.getCenter().z);
-            ball.setPower(-ball.getVelocity_X(),ball.getVelocity_Z());
-        }
-        //짧은 바
-        if (ball.getCenter()[2] <= (-5 + M_RADIUS))	{
-            ball.setCenter(ball.getCenter().x,ball.getCenter().y,(-5 + M_RADIUS));
-            ball.setPower(ball.getVelocity_X(),-ball.getVelocity_Z());
-        };
-        if (ball.getCenter()[2] >= (5 - M_RADIUS)){
-            ball.setCenter(ball.getCenter().x,ball.getCenter().y,(5 - M_RADIUS));
-            ball.setPower(ball.getVelocity_X(),-ball.getVelocity_Z());
-        }
-        }
+		phys::Ball b = ball.state();
+		phys::hitBy(state(), b);
+		ball.setState(b);
     }    
 	
 	
 	void setPosition(float x, float y, float z)
 	{
-		D3DXMATRIX m;
 		this->m_x = x;
 		this->m_z = z;
 
-		D3DXMatrixTranslation(&m, x, y, z);
-		setLocalTransform(m);
+		setLocalTransform(render::translation(x, y, z));
 	}
 
 
 	
     float getHeight(void) const { return M_HEIGHT; }
+
+	phys::Wall state(void) const
+	{
+		phys::Wall w;
+		w.x = m_x; w.z = m_z;
+		w.width = m_width; w.depth = m_depth;
+		w.kind = phys::SOLID_WALL;
+		return w;
+	}
 	
 	
 	
 private :
-    void setLocalTransform(const D3DXMATRIX& mLocal) { m_mLocal = mLocal; }
+    void setLocalTransform(const render::Matrix& mLocal) { m_mLocal = mLocal; }
 	
-	D3DXMATRIX              m_mLocal;
-    D3DMATERIAL9            m_mtrl;
-    ID3DXMesh*              m_pBoundMesh;
+	render::Matrix          m_mLocal;
+    render::Material        m_mtrl;
+    int                     m_box;		// mesh handle of the renderer
 };
 
 // -----------------------------------------------------------------------------
@@ -316,81 +814,39 @@ class CLight {
 public:
     CLight(void)
     {
-        static DWORD i = 0;
-        m_index = i++;
-        D3DXMatrixIdentity(&m_mLocal);
+        m_mLocal = render::identity();
         ::ZeroMemory(&m_lit, sizeof(m_lit));
-        m_pMesh = NULL;
-        m_bound._center = D3DXVECTOR3(0.0f, 0.0f, 0.0f);
-        m_bound._radius = 0.0f;
     }
     ~CLight(void) {}
 public:
-    bool create(IDirect3DDevice9* pDevice, const D3DLIGHT9& lit, float radius = 0.1f)
+    bool create(const render::Light& lit, float radius = 0.1f)
     {
-        if (NULL == pDevice)
-            return false;
-        if (FAILED(D3DXCreateSphere(pDevice, radius, 10, 10, &m_pMesh, NULL)))
-            return false;
-		
-        m_bound._center = lit.Position;
+        m_bound._center = lit.position;
         m_bound._radius = radius;
-		
-        m_lit.Type          = lit.Type;
-        m_lit.Diffuse       = lit.Diffuse;
-        m_lit.Specular      = lit.Specular;
-        m_lit.Ambient       = lit.Ambient;
-        m_lit.Position      = lit.Position;
-        m_lit.Direction     = lit.Direction;
-        m_lit.Range         = lit.Range;
-        m_lit.Falloff       = lit.Falloff;
-        m_lit.Attenuation0  = lit.Attenuation0;
-        m_lit.Attenuation1  = lit.Attenuation1;
-        m_lit.Attenuation2  = lit.Attenuation2;
-        m_lit.Theta         = lit.Theta;
-        m_lit.Phi           = lit.Phi;
+        m_lit = lit;
         return true;
     }
-    void destroy(void)
+    void destroy(void) {}
+    bool setLight(render::Renderer& renderer, const render::Matrix& mWorld)
     {
-        if (m_pMesh != NULL) {
-            m_pMesh->Release();
-            m_pMesh = NULL;
-        }
-    }
-    bool setLight(IDirect3DDevice9* pDevice, const D3DXMATRIX& mWorld)
-    {
-        if (NULL == pDevice)
-            return false;
-		
-        D3DXVECTOR3 pos(m_bound._center);
-        D3DXVec3TransformCoord(&pos, &pos, &m_mLocal);
-        D3DXVec3TransformCoord(&pos, &pos, &mWorld);
-        m_lit.Position = pos;
+        m_lit.position = render::transformCoord(render::transformCoord(m_bound._center, m_mLocal), mWorld);
 		
-        pDevice->SetLight(m_index, &m_lit);
-        pDevice->LightEnable(m_index, TRUE);
+        renderer.setLight(m_lit);
         return true;
     }
 
-    void draw(IDirect3DDevice9* pDevice)
+	// a small white ball where the light is
+    void draw(render::Renderer& renderer)
     {
-        if (NULL == pDevice)
-            return;
-        D3DXMATRIX m;
-        D3DXMatrixTranslation(&m, m_lit.Position.x, m_lit.Position.y, m_lit.Position.z);
-        pDevice->SetTransform(D3DTS_WORLD, &m);
-        pDevice->SetMaterial(&d3d::WHITE_MTRL);
-        m_pMesh->DrawSubset(0);
+        renderer.drawSphere(m_lit.position, m_bound._radius, render::material(render::color(1, 1, 1), 2.0f));
     }
 
-    D3DXVECTOR3 getPosition(void) const { return D3DXVECTOR3(m_lit.Position); }
+    const render::Vec3& getPosition(void) const { return m_lit.position; }
+    const render::Light& getLight(void) const { return m_lit; }
 
 private:
-    DWORD               m_index;
-    D3DXMATRIX          m_mLocal;
-    D3DLIGHT9           m_lit;
-    ID3DXMesh*          m_pMesh;
+    render::Matrix      m_mLocal;
+    render::Light       m_lit;
     d3d::BoundingSphere m_bound;
 };
 
@@ -399,14 +855,44 @@ private:
 // Global variables
 // -----------------------------------------------------------------------------
 CWall	g_legoPlane;
-CWall	g_legowall[4];
-CSphere	g_sphere[6];
-// CSphere	g_target_blueball;
-// CSphere g_target_magentaball;
-CSphere g_target_whiteball;
+std::vector<CWall>		g_legowall;		// one per wall of the level
+std::vector<CSphere>	g_sphere;		// one per ball id of the level
+D3DRenderer				g_renderer;		// draws all of the above (see legoRender.h)
+d3d::Frustum			g_frustum;		// what the camera sees, for culling
+d3d::ResourceRegistry	g_deviceResources;	// kept from Setup() to Cleanup(), across levels
 
 CLight	g_light;
 
+// ball positions, velocities and game progress (see legoPhysics.h). the ball arrays
+// of a level live in g_levelArena
+phys::Arena g_levelArena;
+phys::World g_world;
+// workers for the narrow phase once there are many shots (M splits them)
+phys::ThreadPool* g_physicsPool = NULL;
+// level file given on the command line; the built-in table if empty (see legoLevel.h)
+std::string g_levelFile;
+// every input and physics tick of this game, saved on exit (see legoReplay.h)
+phys::Replay g_replay;
+const char* ReplayFile = "lastgame.rpl";
+// keys and mouse moves from d3d::WndProc, applied at the start of the next tick
+phys::InputQueue g_input;
+// snapshots of this game: Backspace goes back a second, R to just before the shot
+phys::History g_history((int)PhysicsRate * 2);
+// debris of the bricks that break, moved with the physics and drawn in one batch
+phys::ParticlePool g_particles;
+// where the shot would go, drawn dotted while aiming; worked out again only when the
+// aim, the paddle or the bricks change
+phys::AimPreview g_aim;
+const float AimDotSpacing = 0.15f;
+const float AimDotRadius  = 0.03f;
+
+// per-phase frame timing (see legoProfile.h), compiled in with PHYS_PROFILE (the Debug
+// configuration): F1 shows it, F2 writes it to ProfileFile (also done on exit), F3
+// starts over
+ID3DXFont*  g_font = NULL;		// in g_deviceResources
+bool        g_showProfile = false;
+const char* ProfileFile = "profile.txt";
+
 double g_camera_pos[3] = {0.0, 5.0, -8.0};
 
 
@@ -415,165 +901,228 @@ double g_camera_pos[3] = {0.0, 5.0, -8.0};
 // -----------------------------------------------------------------------------
 
 
-void destroyAllLegoBlock(void){}
+// one sphere per ball id, drawn as a box for a brick; a sphere whose ball was
+// removed from the world is not drawn. balls added during play, e.g. when the
+// shot splits, get theirs here, and a reused id takes the color of its new ball.
+bool syncSpheres(void)
+{
+	if ((int)g_sphere.size() < g_world.numBallIds())
+		g_sphere.resize(g_world.numBallIds());
+	for (int i=0;i<g_world.numBalls();i++) {
+		int id = g_world.ballId(i);
+		phys::Ball b = g_world.ball(id);
+		if (false == g_sphere[id].create(sphereColor[b.kind])) return false;
+		if (false == g_sphere[id].setBox(g_renderer, b.width, b.depth)) return false;
+		g_sphere[id].bind(&g_world, id);
+	}
+	return true;
+}
 
-// initialization
-bool Setup()
+// the ray the shot would be launched along: from the shot towards the marker. false
+// when there is nothing to aim
+bool aimRay(d3d::Ray& ray)
+{
+	if (g_world.state() != phys::World::READY || g_world.shot() < 0 || g_world.marker() < 0)
+		return false;
+	phys::Ball s = g_world.ball(g_world.shot()), m = g_world.ball(g_world.marker());
+	render::Vec3 toMarker = render::vec3(m.x - s.x, 0.0f, m.z - s.z);
+	if (render::length(toMarker) <= 0.0f)
+		return false;
+	ray._origin = render::vec3(s.x, s.y, s.z);
+	ray._direction = render::normalize(toMarker);
+	return true;
+}
+
+// follow the aim ray through walls, bricks and paddle. cheap when nothing moved
+void updateAim(void)
+{
+	d3d::Ray ray;
+	if (!aimRay(ray)) {
+		g_aim.clear();
+		return;
+	}
+	float radius = g_world.ball(g_world.shot()).radius;
+	g_aim.update(g_world, ray._origin.x, ray._origin.z, ray._direction.x, ray._direction.z, radius);
+}
+
+// the level: table, walls and balls. everything it allocates goes to g_levelArena
+// (ball arrays) or to the level registry of g_renderer (meshes), so destroyLevel()
+// frees it all at once and F5 can reload it any number of times.
+bool createLevel(void)
 {
 	int i;
-	
-    D3DXMatrixIdentity(&g_mWorld);
-    D3DXMatrixIdentity(&g_mView);
-    D3DXMatrixIdentity(&g_mProj);
-		
+
 	// create plane and set the position
     //create(pDevice, ix, iz, iwidth, iheight, idepth, color)
-    if (false == g_legoPlane.create(Device, -1, -1, 6, 0.03f, 10, d3d::GREEN)) return false;
+    if (false == g_legoPlane.create(g_renderer, -1, -1, 6, 0.03f, 10, d3d::GREEN)) return false;
     g_legoPlane.setPosition(0.0f, -0.0006f / 5, 0.0f);
 	
-	// create walls and set the position. note that there are four walls
-	if (false == g_legowall[0].create(Device, -1, -1, 6, 0.3f, 0.12f, d3d::DARKRED)) return false;
-	g_legowall[0].setPosition(0.0f, 0.12f, 5.0f);
-	if (false == g_legowall[1].create(Device, -1, -1, 0.12f, 0.3f, 10.0f, d3d::DARKRED)) return false;
-	g_legowall[1].setPosition(-3.0f, 0.12f, 0.0f);
-	if (false == g_legowall[2].create(Device, -1, -1, 0.12f, 0.3f, 10.0f, d3d::DARKRED)) return false;
-	g_legowall[2].setPosition(3.0f, 0.12f, 0.0f);
-	if (false == g_legowall[3].create(Device, -1, -1, 6, 0.0f, 0.12f, d3d::GREEN)) return false;
-	g_legowall[3].setPosition(0.0f, 0.12f, -5.0f);
-
-	// create 4 balls and set the position
-	for (i=0;i<4;i++) {
-		if (false == g_sphere[i].create(Device, sphereColor[i])) return false;
-		g_sphere[i].setCenter(spherePos[i][0], (float)M_RADIUS , spherePos[i][1]);
-		g_sphere[i].setPower(0,0);
+	// load the level: yellow bricks, the blue paddle, the magenta shot ball and the
+	// white ball marking the direction of the shot
+	g_world.setArena(&g_levelArena);
+	if (g_levelFile.empty()) {
+		phys::setupDefaultLevel(g_world);
+	}
+	else {
+		std::string error;
+		if (!phys::loadLevel(g_world, g_levelFile.c_str(), error)) {
+			::MessageBox(0, error.c_str(), 0, 0);
+			return false;
+		}
+	}
+	g_world.setInterpolation(true);
+	g_world.setThreadPool(g_physicsPool);
+	g_replay.begin(60, g_levelFile);
+	g_history.clear();
+
+	// create walls and set the position. the floor is drawn flat and green
+	g_legowall.resize(g_world.numWalls());
+	for (i=0;i<g_world.numWalls();i++) {
+		const phys::Wall& w = g_world.wall(i);
+		bool floor = (w.kind == phys::FLOOR_WALL);
+		if (false == g_legowall[i].create(g_renderer, -1, -1, w.width, floor ? 0.0f : 0.3f, w.depth,
+			floor ? d3d::GREEN : d3d::DARKRED)) return false;
+		g_legowall[i].setPosition(w.x, 0.12f, w.z);
 	}
-	
-	// create blue ball for set direction
-    if (false == g_sphere[4].create(Device, sphereColor[4])) return false;
-	g_sphere[4].setCenter(spherePos[4][0], (float)M_RADIUS , spherePos[4][1]);
-    g_sphere[4].setPower(0,0);
-	// create magenta ball for set direction
-    if (false == g_sphere[5].create(Device, sphereColor[5])) return false;
-	g_sphere[5].setCenter(spherePos[5][0], (float)M_RADIUS ,spherePos[5][1]);
-    g_sphere[5].setPower(0,0);
 
-    if (false == g_target_whiteball.create(Device, d3d::WHITE)) return false;
-	g_target_whiteball.setCenter(.0f, (float)M_RADIUS , 5.2f);
-    g_target_whiteball.setPower(0,0);
+	return syncSpheres();
+}
+
+void destroyLevel(void)
+{
+	g_sphere.clear();
+	g_legowall.clear();
+	g_particles.clear();
+	g_aim.clear();
+	g_legoPlane.destroy();
+	g_renderer.destroyMeshes();
+
+	// the world lets go of the arena before it is reset
+	g_world.clear();
+	g_levelArena.reset();
+}
 
+// initialization
+bool Setup()
+{
+	g_physicsPool = new phys::ThreadPool();
+	if (false == g_renderer.create(Device, Height)) return false;
+	if (false == createLevel()) return false;
+
+	if (FAILED(D3DXCreateFont(Device, 16, 0, FW_NORMAL, 1, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS,
+		DEFAULT_QUALITY, FIXED_PITCH | FF_MODERN, "Consolas", &g_font))) return false;
+	g_deviceResources.add(g_font);
 
 	// light setting 
-    D3DLIGHT9 lit;
-    ::ZeroMemory(&lit, sizeof(lit));
-    lit.Type         = D3DLIGHT_POINT;
-    lit.Diffuse      = d3d::WHITE; 
-	lit.Specular     = d3d::WHITE * 0.9f;
-    lit.Ambient      = d3d::WHITE * 0.9f;
-    lit.Position     = D3DXVECTOR3(0.0f, 3.0f, 0.0f);
-    lit.Range        = 100.0f;
-    lit.Attenuation0 = 0.0f;
-    lit.Attenuation1 = 0.9f;
-    lit.Attenuation2 = 0.0f;
-    if (false == g_light.create(Device, lit))
+    if (false == g_light.create(render::tableLight()))
         return false;
 	
-	// Position and aim the camera.
-	D3DXVECTOR3 pos(0.0f, 10.0f, -8.0f);
-	D3DXVECTOR3 target(0.0f, 0.0f, 0.0f);
-	D3DXVECTOR3 up(0.0f, 4.0f, 0.0f);
-	D3DXMatrixLookAtLH(&g_mView, &pos, &target, &up);
-	Device->SetTransform(D3DTS_VIEW, &g_mView);
-	
-	// Set the projection matrix.
-	D3DXMatrixPerspectiveFovLH(&g_mProj, D3DX_PI / 4, (float)Width / (float)Height, 1.0f, 100.0f);
-	Device->SetTransform(D3DTS_PROJECTION, &g_mProj);
+	// Position and aim the camera. legoRender sees the table the same way
+	render::tableCamera((float)Width / (float)Height, g_mView, g_mProj);
+	g_renderer.setCamera(g_mView, g_mProj);
 	
     // Set render states.
     Device->SetRenderState(D3DRS_LIGHTING, TRUE);
     Device->SetRenderState(D3DRS_SPECULARENABLE, TRUE);
     Device->SetRenderState(D3DRS_SHADEMODE, D3DSHADE_GOURAUD);
 	
-	g_light.setLight(Device, g_mWorld);
+	g_light.setLight(g_renderer, g_mWorld);
 	return true;
 }
 
 void Cleanup(void)
 {
-    g_legoPlane.destroy();
-	for(int i = 0 ; i < 4; i++) {
-		g_legowall[i].destroy();
-	}
-    destroyAllLegoBlock();
+	g_replay.save(ReplayFile);
+#if defined(PHYS_PROFILE)
+	phys::profiler().dump(ProfileFile);
+#endif
+
+	destroyLevel();
     g_light.destroy();
+	g_renderer.destroy();
+	g_deviceResources.releaseAll();
+	g_font = NULL;
+	g_levelArena.release();
+	delete g_physicsPool;
+	g_physicsPool = NULL;
 }
 
 
-// timeDelta represents the time between the current image frame and the last image frame.
+// timeDelta is the fixed time of one physics step.
 // the distance of moving balls should be "velocity * timeDelta"
-bool Display(float timeDelta)
+bool Update(float timeDelta)
+{
+	// input since the last tick, then move the balls and resolve collisions with
+	// walls, bricks and the paddle
+	g_history.record(g_world, g_replay);
+	if (g_input.apply(g_world, g_replay, &g_history)) {
+		// F5: start the level over from its file, between two ticks
+		destroyLevel();
+		if (!createLevel()) {
+			::PostQuitMessage(0);
+			return false;
+		}
+		return true;
+	}
+	g_replay.step(g_world, timeDelta);
+	for (int i = 0; i < g_world.numBroken(); i++)
+		g_particles.burst(g_world.broken(i), (D3DCOLOR)sphereColor[phys::BRICK] & 0xffffff);
+	g_particles.update(timeDelta);
+	updateAim();
+	return syncSpheres();
+}
+
+// alpha tells how far this frame lies between the last two physics steps
+bool Display(float alpha)
 {
 	int i=0;
-	int j = 0;
-    static int cnt = 0;
+	int drawn=0;
 
 	if( Device )
 	{
-		Device->Clear(0, 0, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, 0x00afafaf, 1.0f, 0);
-		Device->BeginScene();
-		
-		// update the position of each ball. during update, check whether each ball hit by walls.
-
-		for( i = 0; i < 4; i++) {
-			g_sphere[i].ballUpdate(timeDelta);
-            g_legowall[i].hitBy(g_sphere[5]);
-            if (g_sphere[5].getCenter().z <= (-4.99 + M_RADIUS)) {//MAGENTABALL이 바닥에 닿으면 게임 종료
-                g_sphere[5].setCenter(-15.0f, M_RADIUS, -15.0f);
-                g_sphere[5].setPower(.0f, .0f);
-            }
-        }
-		
-
-        g_sphere[4].ballUpdate(timeDelta);
-        g_sphere[5].ballUpdate(timeDelta);
-        g_target_whiteball.ballUpdate(timeDelta);
-
-		for(i = 0 ;i < 4; i++){
-            if(g_sphere[i].hasIntersected(g_sphere[5])){
-                g_sphere[i].hitBy(g_sphere[5]);
-                g_sphere[i].setCenter(-15.0f, M_RADIUS,-15.0f);
-                g_sphere[i].setPower(.0f, .0f);
-                cnt++;
-                if (cnt == 4) {
-                    g_sphere[5].setCenter(-15.0f, M_RADIUS, -15.0f);
-                    g_sphere[5].setPower(.0f, .0f);
-                }
-
-            }
+		phys::profiler().frame();
+		{
+			phys::ScopedTimer timer(phys::PHASE_DRAW);
+			g_renderer.beginFrame(render::CLEAR_COLOR);
+
+			// draw plane, walls, and spheres; whatever the camera can not see is skipped
+			g_frustum.extract(g_mView * g_mProj);
+			g_legoPlane.draw(g_renderer, g_mWorld, g_frustum);
+
+			for (i=0;i<(int)g_legowall.size();i++) 	{
+				if (g_legowall[i].draw(g_renderer, g_mWorld, g_frustum))
+					drawn++;
+			}
+			for (i=0;i<g_world.numBalls();i++) 	{
+				if (g_sphere[g_world.ballId(i)].draw(g_renderer, g_mWorld, g_frustum, alpha))
+					drawn++;
+			}
+			const render::Material dot = render::material(render::color(1, 1, 1));
+			g_aim.sample(AimDotSpacing, [&dot](float x, float z) {
+				g_renderer.drawSphere(render::vec3(x, (float)M_RADIUS, z), AimDotRadius, dot);
+			});
+			g_light.draw(g_renderer);
+			g_renderer.drawParticles(g_particles.x(), g_particles.y(), g_particles.z(), g_particles.rgb(),
+				g_particles.size(), phys::PARTICLE_SIZE);
+			g_renderer.endFrame();
+
+			// the overlay is D3D only, drawn over the finished frame
+			if (g_showProfile && g_font) {
+				RECT rc = { 10, 10, Width - 10, Height - 10 };
+				Device->BeginScene();
+				char line[64];
+				sprintf(line, "drawn %d of %d walls and balls\n\n", drawn, (int)g_legowall.size() + g_world.numBalls());
+				std::string text = line + phys::profiler().report();
+				g_font->DrawText(NULL, text.c_str(), -1, &rc,
+					DT_LEFT | DT_TOP | DT_NOCLIP, D3DCOLOR_XRGB(0, 0, 0));
+				Device->EndScene();
+			}
 		}
-
-        //파란공 고정
-        D3DXVECTOR3 coord3d = g_sphere[4].getCenter();
-        g_sphere[4].hitBy(g_sphere[5]);
-        g_sphere[4].setCenter(coord3d.x, coord3d.y, coord3d.z);
-        g_sphere[4].setPower(0.0, 0.0);
-
-		// draw plane, walls, and spheres
-		g_legoPlane.draw(Device, g_mWorld);
-
-		for (i=0;i<4;i++) 	{
-			g_legowall[i].draw(Device, g_mWorld);
-            g_sphere[i].draw(Device, g_mWorld);
+		{
+			phys::ScopedTimer timer(phys::PHASE_PRESENT);
+			g_renderer.present();
 		}
 
-        g_sphere[4].draw(Device, g_mWorld);
-		g_sphere[5].draw(Device, g_mWorld);
-        g_target_whiteball.draw(Device, g_mWorld);
-        g_light.draw(Device);
-		
-		Device->EndScene();
-		Device->Present(0, 0, 0, 0);
-		Device->SetTexture( 0, NULL );
-
         // g_target_magentaball.ballUpdate(timeDelta);
 	}
 
@@ -588,7 +1137,6 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     static int old_y = 0;
     static enum { WORLD_MOVE, LIGHT_MOVE, BLOCK_MOVE } move = WORLD_MOVE;
     int x,y,z;
-    static int i = 0;
 	switch( msg ) {
 	case WM_DESTROY:
         {
@@ -609,28 +1157,44 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
                 }
                 break;
 
+            case VK_F1:
+				g_showProfile = !g_showProfile;
+				break;
+            case VK_F2:
+				phys::profiler().dump(ProfileFile);
+				break;
+            case VK_F3:
+				phys::profiler().reset();
+				break;
+            case VK_F5:
+				// start the level over from its file
+				g_input.push(phys::REQUEST_RELOAD);
+				break;
+
             case VK_SPACE:
 			{
-                if (i == 0) {//처음 한 번만 스페이스 누르기 기능 
-				    D3DXVECTOR3 targetpos = g_target_whiteball.getCenter();
-				    D3DXVECTOR3	whitepos = g_sphere[5].getCenter();
-				    double theta = acos(sqrt(pow(targetpos.x - whitepos.x, 2)) / sqrt(pow(targetpos.x - whitepos.x, 2) +
-					    pow(targetpos.z - whitepos.z, 2)));		// �⺻ 1 ��и�
-				    if (targetpos.z - whitepos.z <= 0 && targetpos.x - whitepos.x >= 0) { theta = -theta; }	//4 ��и�
-				    if (targetpos.z - whitepos.z >= 0 && targetpos.x - whitepos.x <= 0) { theta = PI - theta; } //2 ��и�
-				    if (targetpos.z - whitepos.z <= 0 && targetpos.x - whitepos.x <= 0){ theta = PI + theta; } // 3 ��и�
-				    double distance = sqrt(pow(targetpos.x - whitepos.x, 2) + pow(targetpos.z - whitepos.z, 2));
-				    g_sphere[5].setPower(distance * cos(theta)*(0.3), distance * sin(theta)*(0.3));
-                    g_target_whiteball.setCenter(-15.0f, 0, -15.0f);
-                    i = 1;
-                }
+				g_input.push(phys::INPUT_LAUNCH);	//처음 한 번만 스페이스 누르기 기능 
 				
                 break;
             }
+            case 'M':
+				// split every shot in three
+				g_input.push(phys::INPUT_MULTIBALL, 3);
+				break;
+            case VK_BACK:
+				// one second back
+				g_input.push(phys::REQUEST_UNDO, PhysicsRate);
+				break;
+            case 'R':
+				// the shot again, from where it was fired
+				g_input.push(phys::REQUEST_RETRY);
+				break;
 
 			
 
             }
+			// a key is not a mouse move: lParam holds no position
+			break;
     }
         
        
@@ -646,8 +1210,7 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 				dx = (old_x - new_x);// * 0.01f;
 				dy = (old_y - new_y);// * 0.01f;
 		
-				D3DXVECTOR3 coord3d=g_target_whiteball.getCenter();
-				g_target_whiteball.setCenter(coord3d.x+dx*(-0.01f),coord3d.y,coord3d.z);
+				g_input.push(phys::INPUT_MARKER, dx*(-0.01f));
 				
 				
                 old_x = new_x;
@@ -661,8 +1224,7 @@ LRESULT CALLBACK d3d::WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 					dx = (old_x - new_x);// * 0.01f;
 					dy = (old_y - new_y);// * 0.01f;
 		
-					D3DXVECTOR3 coord3d=g_sphere[4].getCenter();
-					g_sphere[4].setCenter(coord3d.x+dx*(-0.01f),coord3d.y,coord3d.z);
+					g_input.push(phys::INPUT_PADDLE, dx*(-0.01f));
 				}
 				old_x = new_x;
 				old_y = new_y;
@@ -683,6 +1245,13 @@ int WINAPI WinMain(HINSTANCE hinstance,
 				   int showCmd)
 {
     srand(static_cast<unsigned int>(time(NULL)));
+
+	// the only argument is an optional level file (.lvl text or compiled .lvb)
+	g_levelFile = cmdLine ? cmdLine : "";
+	while (!g_levelFile.empty() && (g_levelFile[0] == ' ' || g_levelFile[0] == '"'))
+		g_levelFile.erase(0, 1);
+	while (!g_levelFile.empty() && (g_levelFile[g_levelFile.size() - 1] == ' ' || g_levelFile[g_levelFile.size() - 1] == '"'))
+		g_levelFile.erase(g_levelFile.size() - 1);
 	
 	if(!d3d::InitD3D(hinstance,
 		Width, Height, true, D3DDEVTYPE_HAL, &Device))
@@ -697,7 +1266,7 @@ int WINAPI WinMain(HINSTANCE hinstance,
 		return 0;
 	}
 	
-	d3d::EnterMsgLoop( Display );
+	d3d::EnterMsgLoop( Update, Display, PhysicsRate, MaxFrameRate );
 	
 	Cleanup();
 	